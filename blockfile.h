@@ -0,0 +1,578 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef BLOCKFILE_H_
+#define BLOCKFILE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+#include <iostream>
+
+#include "iostats.h"
+#include "iouring.h"
+#include "memorygovernor.h"
+
+using namespace std;
+
+typedef unsigned long long uint64;
+
+/**
+ * A temporary file accessed with positional reads and writes (pread/pwrite),
+ * so that several threads may read it at once.
+ *
+ * If the environment variable ROWREORDER_DIRECTIO is set (and not "0"), the
+ * file is opened with O_DIRECT: the page cache is bypassed, and unaligned
+ * requests go through an aligned staging buffer, a block at a time. Each
+ * thread has one such buffer, leased from the MemoryGovernor on first use
+ * and kept until the thread ends. When the
+ * file system refuses O_DIRECT (e.g., tmpfs), we fall back to buffered I/O
+ * and tell the kernel to drop the pages we are done with (posix_fadvise).
+ *
+ * Every read and write is counted in IOStatistics; a request that does not
+ * start where the previous one on this file ended counts as a seek.
+ *
+ * Large reads and writes are cut into RINGCHUNK pieces that are submitted
+ * together on the io_uring of the calling thread (see IOUring), so that the
+ * device sees a deep queue; without io_uring, we loop over pread/pwrite.
+ */
+class BlockFile {
+public:
+	enum {
+		ALIGNMENT = 4096, STAGINGSIZE = 1048576, RINGCHUNK = 262144
+	};
+
+	BlockFile() :
+		fd(-1), direct(false), nocache(false), extent(0), nextoffset(0) {
+	}
+
+	~BlockFile() {
+		close();
+	}
+
+	static bool directIORequested() {
+		const char * v = getenv("ROWREORDER_DIRECTIO");
+		return (v != NULL) and (strcmp(v, "0") != 0) and (strlen(v) > 0);
+	}
+
+	// creates (or truncates) the file; with truncate == false an existing
+	// file is opened as it is
+	bool open(const char * filename, const bool wantdirect =
+			directIORequested(), const bool truncate = true) {
+		close();
+		int flags = O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0);
+#ifdef O_DIRECT
+		if (wantdirect) {
+			fd = ::open(filename, flags | O_DIRECT, 0600);
+			if (fd >= 0) {
+				direct = true;
+				opened();
+				return true;
+			}
+			if (errno != EINVAL)
+				return false;
+			// the file system does not support it
+		}
+#endif
+		fd = ::open(filename, flags, 0600);
+		if (fd < 0)
+			return false;
+		if (wantdirect) {
+#ifdef F_NOCACHE
+			fcntl(fd, F_NOCACHE, 1);
+#endif
+			nocache = true;
+		}
+#ifdef POSIX_FADV_SEQUENTIAL
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		opened();
+		return true;
+	}
+
+	void close() {
+		if (fd >= 0) {
+			::close(fd);
+			IOStatistics::instance().shrinkFiles(extent);
+		}
+		extent = 0;
+		nextoffset = 0;
+		fd = -1;
+		direct = false;
+		nocache = false;
+	}
+
+	bool isOpen() const {
+		return fd >= 0;
+	}
+
+	bool isDirect() const {
+		return direct;
+	}
+
+	int descriptor() const {
+		return fd;
+	}
+
+	// makes the data written so far durable
+	void sync() {
+#if defined(__APPLE__)
+		if (::fsync(fd) != 0)
+#else
+		if (::fdatasync(fd) != 0)
+#endif
+			failure("bad sync");
+	}
+
+	// the file ends at the given offset
+	void resize(uint64 bytes) {
+		if (::ftruncate(fd, bytes) != 0)
+			failure("bad truncate");
+		const uint64 before = extent.exchange(bytes);
+		if (bytes > before)
+			IOStatistics::instance().growFiles(bytes - before);
+		else
+			IOStatistics::instance().shrinkFiles(before - bytes);
+	}
+
+	void swap(BlockFile & o) {
+		std::swap(fd, o.fd);
+		std::swap(direct, o.direct);
+		std::swap(nocache, o.nocache);
+		const uint64 e = extent;
+		extent = o.extent.load();
+		o.extent = e;
+		const uint64 n = nextoffset;
+		nextoffset = o.nextoffset.load();
+		o.nextoffset = n;
+	}
+
+	// throws if we cannot read all bytes
+	void read(void * out, size_t bytes, uint64 offset) const {
+		countSeek(offset, bytes);
+		char * dst = reinterpret_cast<char *> (out);
+		if (!direct) {
+			if (readLarge(dst, bytes, offset) != bytes)
+				failure("bad read");
+			dropCache(offset, bytes);
+			return;
+		}
+		AlignedBuffer * staging = NULL;
+		while (bytes > 0) {
+			if (isAligned(dst) and (offset % ALIGNMENT == 0) and (bytes
+					>= ALIGNMENT)) {
+				const size_t span = bytes - bytes % ALIGNMENT;
+				if (readLarge(dst, span, offset) != span)
+					failure("bad read");
+				dst += span;
+				offset += span;
+				bytes -= span;
+				continue;
+			}
+			if (staging == NULL)
+				staging = &AlignedBuffer::forThisThread();
+			const uint64 blockstart = offset - offset % ALIGNMENT;
+			const size_t skip = offset - blockstart;
+			size_t useful = STAGINGSIZE - skip;
+			if (useful > bytes)
+				useful = bytes;
+			const size_t span = roundUp(skip + useful);
+			const size_t got = readUpTo(staging->data, span, blockstart);
+			if (got < skip + useful)
+				failure("bad read");
+			memcpy(dst, staging->data + skip, useful);
+			dst += useful;
+			offset += useful;
+			bytes -= useful;
+		}
+	}
+
+	// throws if we cannot write all bytes
+	void write(const void * in, size_t bytes, uint64 offset) {
+		countSeek(offset, bytes);
+		extend(offset + bytes);
+		const char * src = reinterpret_cast<const char *> (in);
+		if (!direct) {
+			writeLarge(src, bytes, offset);
+			dropCache(offset, bytes);
+			return;
+		}
+		AlignedBuffer * staging = NULL;
+		while (bytes > 0) {
+			if (isAligned(src) and (offset % ALIGNMENT == 0) and (bytes
+					>= ALIGNMENT)) {
+				const size_t span = bytes - bytes % ALIGNMENT;
+				writeLarge(src, span, offset);
+				src += span;
+				offset += span;
+				bytes -= span;
+				continue;
+			}
+			// read-modify-write of the partial blocks at either end
+			if (staging == NULL)
+				staging = &AlignedBuffer::forThisThread();
+			const uint64 blockstart = offset - offset % ALIGNMENT;
+			const size_t skip = offset - blockstart;
+			size_t useful = STAGINGSIZE - skip;
+			if (useful > bytes)
+				useful = bytes;
+			const size_t span = roundUp(skip + useful);
+			if (skip > 0)
+				readBlockOrZeroes(staging->data, blockstart);
+			if ((skip + useful) % ALIGNMENT != 0)
+				readBlockOrZeroes(staging->data + span - ALIGNMENT, blockstart
+						+ span - ALIGNMENT);
+			memcpy(staging->data + skip, src, useful);
+			writeFully(staging->data, span, blockstart);
+			src += useful;
+			offset += useful;
+			bytes -= useful;
+		}
+	}
+
+private:
+	friend class IOBatch;
+
+	BlockFile(const BlockFile &);
+	BlockFile & operator=(const BlockFile &);
+
+	// the staging buffer of the calling thread, allocated on first use
+	class AlignedBuffer {
+	public:
+		static AlignedBuffer & forThisThread() {
+			static thread_local AlignedBuffer buffer;
+			return buffer;
+		}
+		AlignedBuffer() :
+			lease(STAGINGSIZE + ALIGNMENT, STAGINGSIZE + ALIGNMENT),
+					data(NULL) {
+			void * p = NULL;
+			if (posix_memalign(&p, ALIGNMENT, STAGINGSIZE + ALIGNMENT) != 0)
+				throw runtime_error("could not allocate aligned buffer");
+			data = reinterpret_cast<char *> (p);
+		}
+		~AlignedBuffer() {
+			free(data);
+		}
+		MemoryLease lease;
+		char * data;
+	private:
+		AlignedBuffer(const AlignedBuffer &);
+		AlignedBuffer & operator=(const AlignedBuffer &);
+	};
+
+	static bool isAligned(const void * p) {
+		return reinterpret_cast<uintptr_t> (p) % ALIGNMENT == 0;
+	}
+
+	static size_t roundUp(size_t x) {
+		return (x + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+
+	// the file may already hold data (opened without truncating)
+	void opened() {
+		struct stat st;
+		extent = (::fstat(fd, &st) == 0) ? st.st_size : 0;
+		nextoffset = 0;
+		IOStatistics::instance().growFiles(extent);
+	}
+
+	void extend(const uint64 end) {
+		uint64 before = extent;
+		while ((end > before) and !extent.compare_exchange_weak(before, end))
+			;
+		if (end > before)
+			IOStatistics::instance().growFiles(end - before);
+	}
+
+	void countSeek(const uint64 offset, const size_t bytes) const {
+		if (nextoffset.exchange(offset + bytes) != offset)
+			IOStatistics::instance().countSeek();
+	}
+
+	static void failure(const char * what) {
+		cerr << what << ": " << strerror(errno) << endl;
+		throw runtime_error(what);
+	}
+
+	// returns fewer bytes than requested only at the end of the file
+	size_t readUpTo(char * dst, size_t bytes, uint64 offset) const {
+		size_t done = 0;
+		while (done < bytes) {
+			const uint64 start = IOStatistics::now();
+			ssize_t result = ::pread(fd, dst + done, bytes - done, offset
+					+ done);
+			IOStatistics::instance().countRead(result > 0 ? result : 0,
+					IOStatistics::now() - start);
+			if (result < 0) {
+				if (errno == EINTR)
+					continue;
+				failure("bad read");
+			}
+			if (result == 0)
+				break;
+			done += result;
+		}
+		return done;
+	}
+
+	// cuts a transfer into RINGCHUNK pieces
+	void split(vector<IORequest> & pieces, char * data, size_t bytes,
+			uint64 offset, const bool write) const {
+		for (size_t done = 0; done < bytes; done += RINGCHUNK) {
+			IORequest r;
+			r.fd = fd;
+			r.data = data + done;
+			r.bytes = bytes - done < RINGCHUNK ? bytes - done : RINGCHUNK;
+			r.offset = offset + done;
+			r.write = write;
+			r.result = 0;
+			pieces.push_back(r);
+		}
+	}
+
+	// counts the pieces that went through a ring, sharing the time
+	static void countPieces(const vector<IORequest> & pieces,
+			const uint64 nanoseconds) {
+		for (size_t k = 0; k < pieces.size(); ++k) {
+			const uint64 got = pieces[k].result > 0 ? pieces[k].result : 0;
+			if (pieces[k].write)
+				IOStatistics::instance().countWrite(got, nanoseconds
+						/ pieces.size());
+			else
+				IOStatistics::instance().countRead(got, nanoseconds
+						/ pieces.size());
+		}
+	}
+
+	// same as readUpTo, on the ring when the transfer is large enough
+	size_t readLarge(char * dst, size_t bytes, uint64 offset) const {
+		IOUring * ring = bytes >= 2 * RINGCHUNK ? IOUring::forThisThread()
+				: NULL;
+		if (ring == NULL)
+			return readUpTo(dst, bytes, offset);
+		vector<IORequest> pieces;
+		split(pieces, dst, bytes, offset, false);
+		const uint64 start = IOStatistics::now();
+		ring->run(&pieces[0], pieces.size());
+		countPieces(pieces, IOStatistics::now() - start);
+		size_t done = 0;
+		for (size_t k = 0; k < pieces.size(); ++k) {
+			// errors and short reads are retried with pread
+			const IORequest & p = pieces[k];
+			size_t got = p.result > 0 ? p.result : 0;
+			if (got < p.bytes)
+				got += readUpTo(p.data + got, p.bytes - got, p.offset + got);
+			done += got;
+			if (got < p.bytes)
+				break;// end of file
+		}
+		return done;
+	}
+
+	// same as writeFully, on the ring when the transfer is large enough
+	void writeLarge(const char * src, size_t bytes, uint64 offset) const {
+		IOUring * ring = bytes >= 2 * RINGCHUNK ? IOUring::forThisThread()
+				: NULL;
+		if (ring == NULL) {
+			writeFully(src, bytes, offset);
+			return;
+		}
+		vector<IORequest> pieces;
+		split(pieces, const_cast<char *> (src), bytes, offset, true);
+		const uint64 start = IOStatistics::now();
+		ring->run(&pieces[0], pieces.size());
+		countPieces(pieces, IOStatistics::now() - start);
+		for (size_t k = 0; k < pieces.size(); ++k) {
+			const IORequest & p = pieces[k];
+			const size_t put = p.result > 0 ? p.result : 0;
+			if (put < p.bytes)
+				writeFully(p.data + put, p.bytes - put, p.offset + put);
+		}
+	}
+
+	void readBlockOrZeroes(char * dst, uint64 offset) const {
+		const size_t got = readUpTo(dst, ALIGNMENT, offset);
+		memset(dst + got, 0, ALIGNMENT - got);
+	}
+
+	void writeFully(const char * src, size_t bytes, uint64 offset) const {
+		while (bytes > 0) {
+			const uint64 start = IOStatistics::now();
+			ssize_t result = ::pwrite(fd, src, bytes, offset);
+			IOStatistics::instance().countWrite(result > 0 ? result : 0,
+					IOStatistics::now() - start);
+			if (result < 0) {
+				if (errno == EINTR)
+					continue;
+				failure("bad write");
+			}
+			src += result;
+			offset += result;
+			bytes -= result;
+		}
+	}
+
+	void dropCache(uint64 offset, size_t bytes) const {
+		if (!nocache)
+			return;
+#ifdef SYNC_FILE_RANGE_WRITE
+		// dirty pages are not dropped: wait for them to reach the disk
+		sync_file_range(fd, offset, bytes, SYNC_FILE_RANGE_WAIT_BEFORE
+				| SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#ifdef POSIX_FADV_DONTNEED
+		posix_fadvise(fd, offset, bytes, POSIX_FADV_DONTNEED);
+#endif
+	}
+
+	int fd;
+	bool direct;
+	bool nocache;
+	atomic<uint64> extent;// bytes in the file, as far as we know
+	mutable atomic<uint64> nextoffset;// where the last request ended
+};
+
+/**
+ * Reads and writes, on any number of files, that go out together: submit()
+ * starts them on the batch's own io_uring and returns, wait() returns once
+ * they are done. Buffers given to read and write must stay valid until
+ * then, unless write is given a vector to keep. At most one submission is
+ * in flight: submit() first waits for the previous one.
+ *
+ * Without io_uring, and for files opened with O_DIRECT (our buffers are
+ * not aligned), each request is done right away with pread/pwrite; so is
+ * a submission of less than 2 * RINGCHUNK bytes.
+ */
+class IOBatch {
+public:
+	IOBatch() :
+		mRing(IOUring::create()), mQueued(), mQueuedFiles(), mQueuedOwned(),
+				mInFlight(), mInFlightFiles(), mInFlightOwned() {
+	}
+	~IOBatch() {
+		if (!mInFlight.empty())
+			mRing->finish();// the kernel must be done with our buffers
+	}
+
+	void read(const BlockFile & f, void * out, size_t bytes, uint64 offset) {
+		if ((mRing.get() == NULL) or f.isDirect()) {
+			f.read(out, bytes, offset);
+			return;
+		}
+		f.countSeek(offset, bytes);
+		queue(f, reinterpret_cast<char *> (out), bytes, offset, false);
+	}
+
+	void write(BlockFile & f, const void * in, size_t bytes, uint64 offset) {
+		if ((mRing.get() == NULL) or f.isDirect()) {
+			f.write(in, bytes, offset);
+			return;
+		}
+		f.countSeek(offset, bytes);
+		f.extend(offset + bytes);
+		queue(f, const_cast<char *> (reinterpret_cast<const char *> (in)),
+				bytes, offset, true);
+	}
+
+	// the batch keeps the vector until the write is done
+	template<class T>
+	void write(BlockFile & f, vector<T> && data, uint64 offset) {
+		if (data.empty())
+			return;
+		OwnedVector<T> * owned = new OwnedVector<T> ();
+		owned->data.swap(data);
+		mQueuedOwned.push_back(unique_ptr<Owned> (owned));
+		write(f, &owned->data[0], owned->data.size() * sizeof(T), offset);
+	}
+
+	void submit() {
+		wait();
+		if (mQueued.empty()) {
+			mQueuedOwned.clear();// written right away
+			return;
+		}
+		mInFlight.swap(mQueued);
+		mInFlightFiles.swap(mQueuedFiles);
+		mInFlightOwned.swap(mQueuedOwned);
+		size_t bytes = 0;
+		for (size_t k = 0; k < mInFlight.size(); ++k)
+			bytes += mInFlight[k].bytes;
+		if (bytes < 2 * BlockFile::RINGCHUNK) {
+			// a round trip through the ring costs more than a few calls
+			complete();
+			return;
+		}
+		mRing->start(&mInFlight[0], mInFlight.size());
+	}
+
+	void wait() {
+		if (mInFlight.empty())
+			return;
+		const uint64 start = IOStatistics::now();
+		mRing->finish();
+		BlockFile::countPieces(mInFlight, IOStatistics::now() - start);
+		complete();
+	}
+
+private:
+	IOBatch(const IOBatch &);
+	IOBatch & operator=(const IOBatch &);
+
+	// finishes the requests in flight with pread/pwrite
+	void complete() {
+		for (size_t k = 0; k < mInFlight.size(); ++k) {
+			// errors and short transfers are retried with pread/pwrite
+			const IORequest & p = mInFlight[k];
+			const BlockFile * f = mInFlightFiles[k];
+			const size_t done = p.result > 0 ? p.result : 0;
+			if ((done < p.bytes) and p.write)
+				f->writeFully(p.data + done, p.bytes - done, p.offset + done);
+			else if ((done < p.bytes) and (f->readUpTo(p.data + done, p.bytes
+					- done, p.offset + done) != p.bytes - done))
+				BlockFile::failure("bad read");
+			f->dropCache(p.offset, p.bytes);
+		}
+		mInFlight.clear();
+		mInFlightFiles.clear();
+		mInFlightOwned.clear();
+	}
+
+	class Owned {
+	public:
+		virtual ~Owned() {
+		}
+	};
+	template<class T>
+	class OwnedVector: public Owned {
+	public:
+		vector<T> data;
+	};
+
+	void queue(const BlockFile & f, char * data, size_t bytes, uint64 offset,
+			const bool write) {
+		f.split(mQueued, data, bytes, offset, write);
+		mQueuedFiles.resize(mQueued.size(), &f);
+	}
+
+	unique_ptr<IOUring> mRing;
+	vector<IORequest> mQueued;
+	vector<const BlockFile *> mQueuedFiles;
+	vector<unique_ptr<Owned> > mQueuedOwned;
+	vector<IORequest> mInFlight;
+	vector<const BlockFile *> mInFlightFiles;
+	vector<unique_ptr<Owned> > mInFlightOwned;
+};
+
+#endif /* BLOCKFILE_H_ */
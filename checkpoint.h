@@ -0,0 +1,181 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <vector>
+#include <stdexcept>
+#include <iostream>
+
+using namespace std;
+
+typedef unsigned int uint;
+typedef unsigned long long uint64;
+
+/**
+ * A directory holding the state of a long job so that it can be resumed
+ * after a crash: persistent data files plus a manifest of "key value"
+ * lines. The manifest is replaced atomically (write, sync, rename), so it
+ * only ever describes files that were synced before it was saved.
+ *
+ * Keys used so far: "input.*" (tods2011: the parsed table) and "sort.*"
+ * (externalvector::sort: the sorted runs and the merge progress).
+ */
+class Checkpoint {
+public:
+	Checkpoint(const string & directory) :
+		mDirectory(directory), mValues() {
+		if ((::mkdir(mDirectory.c_str(), 0700) != 0) and (errno != EEXIST)) {
+			cerr << "Can't create checkpoint directory " << mDirectory << endl;
+			cerr << strerror(errno) << endl;
+			throw runtime_error("could not create checkpoint directory");
+		}
+		load();
+	}
+
+	// ROWREORDER_CHECKPOINT names the directory; NULL if not set
+	static Checkpoint * fromEnvironment() {
+		const char * v = getenv("ROWREORDER_CHECKPOINT");
+		if ((v == NULL) or (*v == '\0'))
+			return NULL;
+		return new Checkpoint(v);
+	}
+
+	const string & directory() const {
+		return mDirectory;
+	}
+
+	// where to keep a data file of the job
+	string path(const string & name) const {
+		return mDirectory + "/" + prefix() + name;
+	}
+
+	bool has(const string & key) const {
+		return mValues.find(key) != mValues.end();
+	}
+
+	string get(const string & key) const {
+		map<string, string>::const_iterator i = mValues.find(key);
+		return i == mValues.end() ? string() : i->second;
+	}
+
+	vector<uint64> getNumbers(const string & key) const {
+		vector<uint64> answer;
+		istringstream in(get(key));
+		uint64 x;
+		while (in >> x)
+			answer.push_back(x);
+		return answer;
+	}
+
+	void set(const string & key, const string & value) {
+		mValues[key] = value;
+	}
+
+	void setNumbers(const string & key, const vector<uint64> & values) {
+		ostringstream out;
+		for (uint k = 0; k < values.size(); ++k)
+			out << (k > 0 ? " " : "") << values[k];
+		set(key, out.str());
+	}
+
+	// forgets all keys starting with keyprefix
+	void erase(const string & keyprefix) {
+		map<string, string>::iterator i = mValues.lower_bound(keyprefix);
+		while ((i != mValues.end()) and (i->first.compare(0, keyprefix.size(),
+				keyprefix) == 0))
+			mValues.erase(i++);
+	}
+
+	// forgets which phases completed (the keys ending in ".done"), so that
+	// a job resumed from here starts over
+	void eraseCompleted() {
+		const string suffix(".done");
+		map<string, string>::iterator i = mValues.begin();
+		while (i != mValues.end())
+			if ((i->first.size() >= suffix.size()) and (i->first.compare(
+					i->first.size() - suffix.size(), suffix.size(), suffix) == 0))
+				mValues.erase(i++);
+			else
+				++i;
+	}
+
+	void save() {
+		const string manifest = path("manifest");
+		const string temporary = manifest + ".new";
+		{
+			ofstream out(temporary.c_str());
+			for (map<string, string>::const_iterator i = mValues.begin(); i
+					!= mValues.end(); ++i)
+				out << i->first << " " << i->second << "\n";
+			out.flush();
+			if (!out) {
+				cerr << "Can't write " << temporary << endl;
+				throw runtime_error("could not save checkpoint");
+			}
+		}
+		const int fd = ::open(temporary.c_str(), O_RDONLY);
+		if (fd >= 0) {
+			::fsync(fd);
+			::close(fd);
+		}
+		if (::rename(temporary.c_str(), manifest.c_str()) != 0) {
+			cerr << "Can't rename " << temporary << ": " << strerror(errno)
+					<< endl;
+			throw runtime_error("could not save checkpoint");
+		}
+	}
+
+	// the job is over: delete the manifest and the data files (other
+	// files in the directory are left alone)
+	void clear() {
+		mValues.clear();
+		DIR * dir = opendir(mDirectory.c_str());
+		if (dir == NULL)
+			return;
+		struct dirent * entry;
+		while ((entry = readdir(dir)) != NULL) {
+			const string name(entry->d_name);
+			if (name.compare(0, prefix().size(), prefix()) == 0)
+				::unlink((mDirectory + "/" + name).c_str());
+		}
+		closedir(dir);
+	}
+
+private:
+	static string prefix() {
+		return "rowreorder-";
+	}
+
+	void load() {
+		ifstream in(path("manifest").c_str());
+		string line;
+		while (getline(in, line)) {
+			const size_t space = line.find(' ');
+			if (space == string::npos)
+				mValues[line] = string();
+			else
+				mValues[line.substr(0, space)] = line.substr(space + 1);
+		}
+	}
+
+	string mDirectory;
+	map<string, string> mValues;
+};
+
+#endif /* CHECKPOINT_H_ */
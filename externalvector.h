@@ -8,45 +8,88 @@
 
 #include <sys/mman.h>
 #include <queue>
+#include <deque>
+#include <exception>
 #include <stdio.h>
 #include <algorithm>
 #include <vector>
+#include <string>
+#include <sstream>
 #include <cassert>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdexcept>
 #include <sys/stat.h>
 #include <unistd.h>
+#include "threadpool.h"
+#include "blockfile.h"
+#include "fastrandom.h"
+#include "spillmanager.h"
+#include "prefixruns.h"
+#include "memorygovernor.h"
+#include "checkpoint.h"
+#include "iostats.h"
 using namespace std;
 
 typedef unsigned int uint;
 typedef unsigned long long uint64;
 
-template<class DataType, class CMP>
-class BinaryFileBuffer {
+// Storage for one merge reader: the chunk being consumed and the chunk
+// being fetched in the background by the I/O thread pool.
+template<class DataType>
+class PrefetchBuffer {
 public:
 	enum {
-		BUFFERSIZE = 512
+		DEFAULTCHUNKBYTES = 262144
 	};
-	FILE *fd;
-	vector<DataType>* buf;
+	PrefetchBuffer() :
+		current(), next(), pending(), nextbegin(0), byteposition(0),
+				nextbyteposition(0), byteend(0), chunkbytes(DEFAULTCHUNKBYTES) {
+	}
+	~PrefetchBuffer() {
+		wait();
+	}
+	void wait() {
+		if (pending.valid())
+			pending.wait();
+	}
+	vector<DataType> current, next;
+	future<void> pending;
+	uint64 nextbegin;// where the chunk in "next" starts
+	// for prefix-truncated runs, offsets are in bytes, not rows
+	uint64 byteposition;// where the bytes after "current" start
+	uint64 nextbyteposition;// where the bytes after "next" start
+	uint64 byteend;
+	uint64 chunkbytes;// size of a read, set by the merge from its memory lease
+private:
+	PrefetchBuffer(const PrefetchBuffer &);
+	PrefetchBuffer & operator=(const PrefetchBuffer &);
+};
+
+template<class DataType, class CMP>
+class BinaryFileBuffer {
+public:
+	const BlockFile * fd;
+	const PrefixRunCodec<DataType> * codec;// NULL unless prefix-truncated
+	PrefetchBuffer<DataType>* buf;
 	uint64 currentpointer, mEnd;
 	uint localpointer;
 	bool valid;
 	CMP mCmp;
 
 	BinaryFileBuffer(const BinaryFileBuffer & o) :
-		fd(o.fd), buf(o.buf), currentpointer(o.currentpointer), mEnd(o.mEnd),
+		fd(o.fd), codec(o.codec), buf(o.buf), currentpointer(o.currentpointer), mEnd(o.mEnd),
 				localpointer(o.localpointer), valid(o.valid), mCmp(o.mCmp) {
 	}
 	BinaryFileBuffer() :
-		fd(NULL), buf(NULL), currentpointer(0), mEnd(0), localpointer(0),
+		fd(NULL), codec(NULL), buf(NULL), currentpointer(0), mEnd(0), localpointer(0),
 				valid(false), mCmp(CMP()) {
 	}
 
 	BinaryFileBuffer<DataType, CMP> & operator=(
 			const BinaryFileBuffer<DataType, CMP> &o) {
 		fd = o.fd;
+		codec = o.codec;
 		buf = o.buf;
 		currentpointer = o.currentpointer;
 		mEnd = o.mEnd;
@@ -55,15 +98,42 @@ public:
 		mCmp = o.mCmp;
 		return *this;
 	}
-	BinaryFileBuffer(FILE * f, uint64 start, uint64 end, CMP cmp,
-			vector<DataType>& Buf) :
-		fd(f), buf(&Buf), currentpointer(start), mEnd(end), localpointer(0),
+	// f must be flushed: we read with positional reads so that several
+	// readers can have requests in flight on the same file
+	BinaryFileBuffer(const BlockFile * f, uint64 start, uint64 end, CMP cmp,
+			PrefetchBuffer<DataType>& Buf) :
+		fd(f), codec(NULL), buf(&Buf), currentpointer(start), mEnd(end), localpointer(0),
 				valid(true), mCmp(cmp) {
-		buf->reserve(BUFFERSIZE);
+		buf->current.reserve(chunkSize());
+		buf->next.reserve(chunkSize());
+		reload();
+	}
+
+	// reads a prefix-truncated run of numberofrows rows stored in
+	// numberofbytes bytes
+	BinaryFileBuffer(const BlockFile * f, const PrefixRunCodec<DataType> * c,
+			uint64 numberofrows, uint64 numberofbytes, CMP cmp,
+			PrefetchBuffer<DataType>& Buf) :
+		fd(f), codec(c), buf(&Buf), currentpointer(0), mEnd(numberofrows),
+				localpointer(0), valid(true), mCmp(cmp) {
+		buf->byteposition = 0;
+		buf->byteend = numberofbytes;
 		reload();
 	}
 
+	uint64 chunkSize() const {
+		return sizeof(DataType) >= buf->chunkbytes ? 1 : buf->chunkbytes
+				/ sizeof(DataType);
+	}
+
 	void reset(uint64 start) {
+		if ((codec != NULL) and (start != 0))
+			throw runtime_error("can only rewind prefix-truncated runs to the start");
+		buf->wait();
+		if (buf->pending.valid())
+			buf->pending = future<void> ();
+		buf->byteposition = 0;
+		buf->current.clear();
 		currentpointer = start;
 		localpointer = 0;
 		valid = true;
@@ -76,33 +146,106 @@ public:
 
 	void reload() {
 		assert(currentpointer<=mEnd);
-		uint howmanycanIread = BUFFERSIZE;
+		uint64 howmanycanIread = chunkSize();
 		if (howmanycanIread > mEnd - currentpointer)
 			howmanycanIread = mEnd - currentpointer;
 		if (howmanycanIread == 0) {
-			buf->resize(0);
+			buf->current.resize(0);
 			valid = false;
 			return;
 		}
-		buf->resize(howmanycanIread);
-
-		int result = fseek(fd, currentpointer * sizeof(DataType), SEEK_SET);
-		if (result != 0) {
-			cerr << "failed to seek" << endl;
-			throw runtime_error("failed to seek");
+		if (codec != NULL) {
+			reloadPrefixRun();
+			return;
 		}
-		size_t howmany = fread(&((*buf)[0]), sizeof(DataType), howmanycanIread,
-				fd);
-		if (howmany != howmanycanIread) {
-			cerr << " Expected to read " << howmanycanIread << " but found "
-					<< howmany << endl;
-			throw runtime_error("failed to read the number expected");
+		if (buf->pending.valid() && (buf->nextbegin == currentpointer)) {
+			const uint64 start = IOStatistics::now();
+			buf->pending.get();// rethrows if the background read failed
+			IOStatistics::instance().countWait(IOStatistics::now() - start);
+			buf->current.swap(buf->next);
+		} else {
+			buf->wait();
+			buf->pending = future<void> ();
+			readChunk(fd, buf->current, currentpointer, howmanycanIread);
 		}
-
 		localpointer = 0;
+		// while the caller consumes this chunk, fetch the next one
+		const uint64 nextbegin = currentpointer + buf->current.size();
+		if (nextbegin < mEnd) {
+			uint64 howmanynext = chunkSize();
+			if (howmanynext > mEnd - nextbegin)
+				howmanynext = mEnd - nextbegin;
+			buf->nextbegin = nextbegin;
+			const BlockFile * thisfd = fd;
+			vector<DataType> * target = &(buf->next);
+			buf->pending = ioThreadPool().submit([thisfd, target, nextbegin,
+					howmanynext]() {
+						readChunk(thisfd, *target, nextbegin, howmanynext);
+					});
+		}
 	}
 
+	static void readChunk(const BlockFile * fd, vector<DataType> & out,
+			uint64 begin, uint64 howmany) {
+		out.resize(howmany);
+		fd->read(&out[0], howmany * sizeof(DataType), begin * sizeof(DataType));
+	}
+
+	// same as reload, but rows are decoded (by the background task) and
+	// chunks are delimited in bytes
+	void reloadPrefixRun() {
+		if (buf->pending.valid() && (buf->nextbegin == currentpointer)) {
+			const uint64 start = IOStatistics::now();
+			buf->pending.get();
+			IOStatistics::instance().countWait(IOStatistics::now() - start);
+			buf->current.swap(buf->next);
+			buf->byteposition = buf->nextbyteposition;
+		} else {
+			buf->wait();
+			buf->pending = future<void> ();
+			DataType previous = buf->current.empty() ? DataType()
+					: buf->current.back();
+			buf->byteposition += decodeChunk(fd, codec, buf->current,
+					buf->byteposition, buf->byteend, mEnd - currentpointer,
+					previous, buf->chunkbytes);
+		}
+		localpointer = 0;
+		const uint64 nextbegin = currentpointer + buf->current.size();
+		if (nextbegin < mEnd) {
+			buf->nextbegin = nextbegin;
+			const BlockFile * thisfd = fd;
+			const PrefixRunCodec<DataType> * thiscodec = codec;
+			PrefetchBuffer<DataType> * target = buf;
+			const uint64 rowsleft = mEnd - nextbegin;
+			const DataType previous = buf->current.back();
+			buf->pending = ioThreadPool().submit([thisfd, thiscodec, target,
+					rowsleft, previous]() {
+						target->nextbyteposition = target->byteposition
+						+ decodeChunk(thisfd, thiscodec, target->next,
+								target->byteposition, target->byteend, rowsleft,
+								previous, target->chunkbytes);
+					});
+		}
+	}
 
+	static uint64 decodeChunk(const BlockFile * fd,
+			const PrefixRunCodec<DataType> * codec, vector<DataType> & out,
+			uint64 bytebegin, uint64 byteend, uint64 maxrows, DataType previous,
+			uint64 chunkbytes) {
+		uint64 howmanybytes = chunkbytes < 2 * PrefixRunCodec<DataType>::MAXROWBYTES ? 2
+				* PrefixRunCodec<DataType>::MAXROWBYTES : chunkbytes;
+		if (howmanybytes > byteend - bytebegin)
+			howmanybytes = byteend - bytebegin;
+		vector<unsigned char> raw(howmanybytes);
+		if (howmanybytes > 0)
+			fd->read(&raw[0], howmanybytes, bytebegin);
+		out.clear();
+		const uint64 consumed = howmanybytes == 0 ? 0 : codec->decode(&raw[0],
+				howmanybytes, maxrows, previous, out);
+		if (out.empty())
+			throw runtime_error("truncated prefix-truncated run");
+		return consumed;
+	}
 
 	bool hasMore() {
 		return valid;
@@ -112,7 +255,7 @@ public:
 	}
 
 	const DataType & peek() const {
-		return (*buf)[localpointer];
+		return buf->current[localpointer];
 	}
 
 	bool operator<(const BinaryFileBuffer<DataType, CMP> & bfb) const {
@@ -124,15 +267,99 @@ public:
 	}
 	void pop(DataType & container) {
 		++currentpointer;
-		container = (*buf)[localpointer++];
-		assert(localpointer<=buf->size());
-		if (localpointer == buf->size())
+		container = buf->current[localpointer++];
+		assert(localpointer<=buf->current.size());
+		if (localpointer == buf->current.size())
 			reload();
 	}
 private:
 
 };
 
+template<class DataType>
+class externalrange;
+
+// Column order in which sorted runs are prefix-truncated. Comparators
+// that are lexicographic over some column order should overload this;
+// by default we use the storage order.
+template<class CMP>
+vector<uint> runColumnOrder(const CMP &) {
+	return vector<uint> ();
+}
+
+// Sorts a block in memory during run generation. Comparators that know
+// a faster way (e.g., a radix sort) should overload this.
+template<class DataType, class CMP>
+void sortBlock(vector<DataType> & buffer, CMP & comparator) {
+	std::sort(buffer.begin(), buffer.end(), comparator);
+}
+
+enum {
+	MAXNATURALRUNS = 16
+};
+
+// Sorts a block during run generation, taking advantage of existing order
+// (as timsort does): the block is cut into maximal non-descending or
+// strictly descending runs, descending runs are reversed, and if there are
+// at most MAXNATURALRUNS of them they are merged pairwise. Otherwise (we
+// stop counting as soon as there are too many), it goes to sortBlock.
+// Returns false if the block was already in order.
+template<class DataType, class CMP>
+bool adaptiveSortBlock(vector<DataType> & buffer, CMP & comparator) {
+	const uint64 n = buffer.size();
+	vector<uint64> runstarts;
+	bool reversed = false;
+	uint64 i = 0;
+	while (i < n) {
+		if (runstarts.size() == MAXNATURALRUNS) {
+			sortBlock(buffer, comparator);
+			return true;
+		}
+		runstarts.push_back(i);
+		uint64 j = i + 1;
+		if ((j < n) and comparator(buffer[j], buffer[j - 1])) {
+			while ((j < n) and comparator(buffer[j], buffer[j - 1]))
+				++j;
+			std::reverse(buffer.begin() + i, buffer.begin() + j);
+			reversed = true;
+		} else
+			while ((j < n) and !comparator(buffer[j], buffer[j - 1]))
+				++j;
+		i = j;
+	}
+	if (runstarts.size() <= 1)
+		return reversed;
+	runstarts.push_back(n);
+	// merge neighbouring runs until one is left
+	while (runstarts.size() > 2) {
+		vector<uint64> merged;
+		uint64 r = 0;
+		for (; r + 2 < runstarts.size(); r += 2) {
+			std::inplace_merge(buffer.begin() + runstarts[r], buffer.begin()
+					+ runstarts[r + 1], buffer.begin() + runstarts[r + 2],
+					comparator);
+			merged.push_back(runstarts[r]);
+		}
+		if (r + 1 < runstarts.size())
+			merged.push_back(runstarts[r]);// odd run out
+		merged.push_back(n);
+		runstarts.swap(merged);
+	}
+	return true;
+}
+
+enum {
+	PLAINRUNS, PREFIXRUNS
+};
+
+// ROWREORDER_PREFIXRUNS=1 selects prefix-truncated runs by default
+inline int defaultRunFormat() {
+	const char * v = getenv("ROWREORDER_PREFIXRUNS");
+	if ((v != NULL) and (strlen(v) > 0) and (strcmp(v, "0") != 0))
+		return PREFIXRUNS;
+	return PLAINRUNS;
+}
+
 template<class DataType>
 class externalvector {
 
@@ -148,11 +375,26 @@ public:
 	typedef DataType& reference;
 	typedef const DataType& const_reference;
 	externalvector() :
-		fd(NULL),N(0), mFileName(NULL) {
+		mFile(), N(0), mFlushed(0), mTail(), mFileName(), mSpillDir(-1), mReservedBytes(0), mPersistent(false) {
 	}
+	// the file is closed (and deleted, unless it is persistent)
 	~externalvector() {
+		close();
 	}
-	externalvector<DataType> top(uint64 number, const uint64 BLOCKSIZE =DEFAULTBLOCKSIZE) const {
+	// the file changes hands; other is left empty
+	externalvector(externalvector<DataType> && other) noexcept :
+		mFile(), N(0), mFlushed(0), mTail(), mFileName(), mSpillDir(-1), mReservedBytes(0), mPersistent(false) {
+		swap(other);
+	}
+	externalvector<DataType> & operator=(externalvector<DataType> && other) noexcept {
+		if (this != &other) {
+			close();
+			swap(other);
+		}
+		return *this;
+	}
+	// copies the first elements into a new file, see also range and truncate
+	externalvector<DataType> top(uint64 number, const uint64 BLOCKSIZE =defaultBlockSize()) const {
 		if(size()<number) number = size();
 		externalvector<DataType> ans;
 		ans.open();
@@ -170,74 +412,86 @@ public:
 
 	}
 
-	externalvector<DataType> buildSample(const uint number) {
+	// Random sample (with replacement). We draw all positions first and sort
+	// them so that the file is read in one forward sweep.
+	externalvector<DataType> buildSample(const uint number, const uint64 seed = 0) const {
 		externalvector<DataType> ans;
 		ans.open();
-
-		int result =fseek(fd, 0L, SEEK_END);
-		if(result != 0) {
-			cerr<<"could not determine file size"<<endl;
-		}
-		//cout<< "file size= "<<ftell(fd)<< endl;
-		DataType buffer;
-		while(ans.size()<number) {
-			const uint64 pos =rand()%N;
-			//cout<<"reading at pos "<<pos<<endl;
-			//int result =
-			fseek(fd, pos * sizeof(DataType), SEEK_SET);
-			//if (result != 0) {
-			//			cerr << "could not seek to " << pos << endl;
-			//			throw runtime_error("bad seek");
-			//}
-			//size_t howmany =
-			fread(&buffer, sizeof(DataType), 1,fd);
-			//if (howmany !=  1) {
-			//			cerr << "Error reading from file " << endl;
-			//			cerr << strerror(errno) << endl;
-			//			throw runtime_error("bad read");
-			//}
-			ans.append(buffer);
-		}
+		if (N == 0)
+			return ans;
+		FastRandom rng(seed);
+		vector<uint64> positions(number);
+		for (uint k = 0; k < number; ++k)
+			positions[k] = rng.uniform(N);
+		std::sort(positions.begin(), positions.end());
+		vector<DataType> buffer;
+		gather(positions, buffer);
+		ans.append(buffer);
 		return ans;
 
 	}
 
+	enum{GATHERBYTES=1048576};
+
+	// Loads the elements at the given (sorted) positions. Positions that fall
+	// within GATHERBYTES of each other are served by the same read. The
+	// positions are split among the I/O threads, each reading its own range.
+	void gather(const vector<uint64> & sortedpositions, vector<DataType> & out) const {
+		out.resize(sortedpositions.size());
+		if (sortedpositions.empty())
+			return;
+		ThreadPool & pool = ioThreadPool();
+		const uint64 howmany = sortedpositions.size();
+		uint64 parts = pool.size();
+		if (parts > howmany)
+			parts = howmany;
+		vector<future<void> > done;
+		for (uint64 part = 0; part < parts; ++part) {
+			const uint64 b = howmany * part / parts;
+			const uint64 e = howmany * (part + 1) / parts;
+			done.push_back(pool.submit([this, &sortedpositions, &out, b, e]() {
+						gatherRange(sortedpositions, out, b, e);
+					}));
+		}
+		for (uint64 part = 0; part < done.size(); ++part)
+			done[part].get();
+	}
+
 	externalvector(const externalvector<DataType> & other) :
-		fd(NULL),  N(0),  mFileName(NULL) {
-		if ((other.fd != NULL) or (fd != NULL)) {
+		mFile(), N(0), mFlushed(0), mTail(), mFileName(), mSpillDir(-1), mReservedBytes(0), mPersistent(false) {
+		if (other.mFile.isOpen() or mFile.isOpen()) {
 			cerr << "please don't use copy constructor for non-trivial things"
 					<< endl;
 			throw runtime_error("you are abusing copy constructor");
 		}
-		assert(other.fd==NULL);
 		assert(other.N==0);
 	}
 	externalvector<DataType> & operator=(const externalvector<DataType> & other) {
-		if ((other.fd != NULL) or (fd != NULL)) {
+		if (other.mFile.isOpen() or mFile.isOpen()) {
 			cerr << "please don't use assignment for non-trivial things"
 					<< endl;
 			throw runtime_error("you are abusing assignment operator");
 		}
-		assert(other.fd==NULL);
 		assert(other.N==0);
-		fd = NULL;
 		N = 0;
-		mFileName = NULL;
+		mFlushed = 0;
+		mTail.clear();
+		mFileName.clear();
+		mSpillDir = -1;
+		mReservedBytes = 0;
+		mPersistent = false;
 		return *this;
 	}
 
 	void swap(externalvector<DataType> & o) {
-		FILE * tmpfd = fd;
-		uint64 tmpN = N;
-		char * tmpFileName = mFileName;
-		//
-		fd = o.fd;
-		N = o.N;
-		mFileName = o.mFileName;
-		//
-		o.fd = tmpfd;
-		o.N = tmpN;
-		o.mFileName = tmpFileName;
+		mFile.swap(o.mFile);
+		std::swap(N, o.N);
+		std::swap(mFlushed, o.mFlushed);
+		mTail.swap(o.mTail);
+		mFileName.swap(o.mFileName);
+		std::swap(mSpillDir, o.mSpillDir);
+		std::swap(mReservedBytes, o.mReservedBytes);
+		std::swap(mPersistent, o.mPersistent);
 	}
 	off_t getFileSize(char * filename) {
 		struct stat s;
@@ -247,41 +501,207 @@ public:
 
 	off_t getFileSize() {
 		struct stat s;
-		lstat(mFileName, &s);
+		lstat(mFileName.c_str(), &s);
 		return s.st_size;
 	}
 
-	enum{DEFAULTBLOCKSIZE=4194304};
+	// Elements per block when the caller does not say: a quarter of the
+	// memory budget. It does not depend on what is leased at the time, so
+	// that a run with a given budget always cuts its blocks the same way.
+	enum{MINIMUMBLOCKSIZE=1024};
+	static uint64 defaultBlockSize() {
+		const uint64 answer = MemoryGovernor::instance().budget() / 4
+				/ sizeof(DataType);
+		return answer < MINIMUMBLOCKSIZE ? MINIMUMBLOCKSIZE : answer;
+	}
 
-	// this is not a true shuffle, it shuffles by block,
-	// blocks are *not* merged. For my purposes, I did not
-	// need a true shuffle.
-	void shuffle(const uint64 BLOCKSIZE =DEFAULTBLOCKSIZE) {
+	// appends are gathered in memory and written this many bytes at a time
+	enum{APPENDBUFFERBYTES=1048576};
+
+	// bounds on the size of a read during the merge
+	enum{MINMERGECHUNKBYTES=65536, MAXMERGECHUNKBYTES=4194304};
+
+	// a checkpointed merge records its progress after this many bytes
+	enum{MERGECHECKPOINTBYTES=268435456};
+
+	// isSorted reads this many elements first, then twice as many...
+	enum{SORTEDCHECKCHUNK=4096};
+
+	// Uniform shuffle. Each row is sent to a random bucket (one pass,
+	// sequential writes), then each bucket is shuffled in memory and
+	// written back in place. There are up to SHUFFLEPARTS buckets per
+	// block, and we shuffle as many buckets at once as fit in a block.
+	// There are at most MAXSHUFFLEFILES buckets (temporary files); larger
+	// buckets go through another pass.
+	// The result only depends on the seed and the block size, not on the
+	// number of threads. The scatter leases its block, and a copy of it,
+	// from the MemoryGovernor whatever the budget, as the block size sets
+	// the result; the gather shuffles fewer buckets at once when the
+	// budget is short.
+	enum{SHUFFLEPARTS=8, MAXSHUFFLEBUCKETS=512, MAXSHUFFLEFILES=1024};
+	void shuffle(const uint64 BLOCKSIZE =defaultBlockSize(), const uint64 seed = 0) {
+		if (size() == 0)
+			return;
+		flush();
+		ThreadPool & pool = computeThreadPool();
 		vector<DataType> buffer;
+		if (size() <= BLOCKSIZE) {
+			MemoryLease lease(size() * sizeof(DataType), size() * sizeof(DataType));
+			loadACopy(buffer, 0, size());
+			FastRandom rng(seed, 0);
+			rng.shuffle(buffer.begin(), buffer.end());
+			copyAt(buffer, 0);
+			return;
+		}
+		const uint64 howmanyblocks = size() / BLOCKSIZE + (size() % BLOCKSIZE
+				== 0 ? 0 : 1);
+		uint64 howmanybuckets = howmanyblocks * SHUFFLEPARTS;
+		if (howmanybuckets > MAXSHUFFLEBUCKETS)
+			howmanybuckets = howmanyblocks * 2 > MAXSHUFFLEBUCKETS ? howmanyblocks
+					* 2 : MAXSHUFFLEBUCKETS;
+		// each bucket is a temporary file
+		if (howmanybuckets > MAXSHUFFLEFILES)
+			howmanybuckets = MAXSHUFFLEFILES;
+		uint64 concurrency = howmanybuckets / howmanyblocks;
+		if (concurrency > pool.size())
+			concurrency = pool.size();
+		if (concurrency < 1)
+			concurrency = 1;
+		vector<externalvector<DataType> > buckets(howmanybuckets);
+		for (uint64 b = 0; b < howmanybuckets; ++b)
+			buckets[b].open();
+		// scatter: each slice of a block draws from its own generator
+		PhaseTimer scattering("shuffle: scatter");
+		MemoryLease scatterlease(2 * BLOCKSIZE * sizeof(DataType), 2 * BLOCKSIZE
+				* sizeof(DataType));
+		vector<uint> bucketof;
+		vector<vector<DataType> > outgoing(howmanybuckets);
 		for (uint64 k = 0; k < size(); k += BLOCKSIZE) {
-			if (k + BLOCKSIZE < size()) {
-				loadACopy(buffer,k,k+BLOCKSIZE);
-				random_shuffle(buffer.begin(), buffer.end());
-				copyAt(buffer,k);
-			} else {
-				loadACopy(buffer,k,size());
-				random_shuffle(buffer.begin(), buffer.end());
-				copyAt(buffer,k);
+			const uint64 end = k + BLOCKSIZE < size() ? k + BLOCKSIZE : size();
+			loadACopy(buffer, k, end);
+			bucketof.resize(buffer.size());
+			const uint64 slicesize = (buffer.size() + SHUFFLEPARTS - 1)
+					/ SHUFFLEPARTS;
+			vector<future<void> > done;
+			for (uint64 slice = 0; slice * slicesize < buffer.size(); ++slice) {
+				uint * target = &bucketof[0];
+				const uint64 b = slice * slicesize;
+				const uint64 e = b + slicesize < buffer.size() ? b + slicesize
+						: buffer.size();
+				const uint64 stream = (k / BLOCKSIZE) * SHUFFLEPARTS + slice;
+				done.push_back(pool.submit([target, b, e, seed, stream,
+						howmanybuckets]() {
+							FastRandom rng(seed, stream + 1);
+							for (uint64 i = b; i < e; ++i)
+							target[i] = rng.uniform(howmanybuckets);
+						}));
 			}
-			cout << "#completed block " << (k) / BLOCKSIZE << " out of "
-					<< (size() / BLOCKSIZE
-							+ (size() % BLOCKSIZE == 0 ? 0 : 1))
-					<< " blocks" << endl;
+			for (uint x = 0; x < done.size(); ++x)
+				done[x].get();
+			for (uint64 i = 0; i < buffer.size(); ++i)
+				outgoing[bucketof[i]].push_back(buffer[i]);
+			for (uint64 b = 0; b < howmanybuckets; ++b) {
+				buckets[b].append(outgoing[b]);
+				outgoing[b].clear();
+			}
+			cout << "#scattered block " << k / BLOCKSIZE + 1 << " out of "
+					<< howmanyblocks << endl;
 		}
-
+		vector<DataType>().swap(buffer);
+		vector<uint>().swap(bucketof);
+		vector<vector<DataType> >(howmanybuckets).swap(outgoing);
+		scatterlease.release();
+		// gather: shuffle the buckets in parallel; the calling thread writes
+		// them back in order, as concurrent writes sharing a block are not
+		// safe with O_DIRECT (see BlockFile::write). A bucket larger than a
+		// block (there are at most MAXSHUFFLEFILES of them) is shuffled
+		// with another pass of this algorithm and copied back.
+		scattering.stop();
+		PhaseTimer gathering("shuffle: gather");
+		uint64 largest = 0;
+		for (uint64 b = 0; b < howmanybuckets; ++b)
+			if ((buckets[b].size() <= BLOCKSIZE) and (buckets[b].size() > largest))
+				largest = buckets[b].size();
+		MemoryLease gatherlease(concurrency * largest * sizeof(DataType),
+				largest * sizeof(DataType));
+		if ((largest > 0) and (gatherlease.bytes() < concurrency * largest
+				* sizeof(DataType))) {
+			concurrency = gatherlease.bytes() / (largest * sizeof(DataType));
+			if (concurrency < 1)
+				concurrency = 1;
+		}
+		uint64 offset = 0;
+		deque<future<vector<DataType> > > pending;
+		exception_ptr failure;
+		for (uint64 x = 0; (x < howmanybuckets) or !pending.empty();) {
+			const bool large = (x < howmanybuckets) and (buckets[x].size()
+					> BLOCKSIZE);
+			if (!failure and (x < howmanybuckets) and !large
+					and (pending.size() < concurrency)) {
+				externalvector<DataType> * bucket = &buckets[x];
+				pending.push_back(pool.submit([bucket, seed, x, howmanyblocks]() {
+					vector<DataType> content;
+					bucket->loadACopy(content, 0, bucket->size());
+					FastRandom rng(seed, howmanyblocks * SHUFFLEPARTS + x + 1);
+					rng.shuffle(content.begin(), content.end());
+					return content;
+				}));
+				++x;
+				continue;
+			}
+			if (pending.empty()) {
+				if (failure)
+					break;
+				// a large bucket, with nothing in flight before it
+				buckets[x].shuffle(BLOCKSIZE, FastRandom::mix(seed
+						^ (howmanyblocks * SHUFFLEPARTS + x + 1)));
+				for (uint64 k = 0; k < buckets[x].size(); k += BLOCKSIZE) {
+					buckets[x].loadACopy(buffer, k, k + BLOCKSIZE
+							< buckets[x].size() ? k + BLOCKSIZE : buckets[x].size());
+					copyAt(buffer, offset);
+					offset += buffer.size();
+				}
+				buffer.clear();
+				buckets[x].close();
+				++x;
+				continue;
+			}
+			vector<DataType> content;
+			try {
+				content = pending.front().get();
+			} catch (...) {
+				if (!failure)
+					failure = current_exception();
+			}
+			pending.pop_front();
+			if (!failure) {
+				copyAt(content, offset);
+				offset += content.size();
+			}
+			buckets[x - pending.size() - 1].close();
+		}
+		if (failure)
+			rethrow_exception(failure);
+		assert(offset == size());
 	}
 
-
-
-
-
+	// With runformat == PREFIXRUNS, the sorted runs are written in the
+	// compact format of PrefixRunCodec (when DataType allows it) and
+	// decoded by the merge readers.
+	//
+	// With a checkpoint, the runs and the merged output are persistent
+	// files of the checkpoint directory and the manifest records each
+	// completed run and, periodically, the merge progress (keys starting
+	// with name). Calling sort again after a crash, on the same input,
+	// resumes from there; the input is not read again once all runs exist.
+	//
+	// Existing order is exploited: sorted input is detected by a scan and
+	// left alone, blocks made of a few ordered runs are merged rather than
+	// sorted (adaptiveSortBlock), and sorted blocks that do not overlap
+	// are concatenated instead of merged.
 	template<class CMP>
-	void sort(CMP & comparator,const uint64 BLOCKSIZE =DEFAULTBLOCKSIZE) {
+	void sort(CMP & comparator,const uint64 requestedblocksize =defaultBlockSize(), const int requestedrunformat = defaultRunFormat(),
+			Checkpoint * checkpoint = NULL, const string & name = "sort") {
 		 //;//1024*10;
 		// first you sort blocks
 		//
@@ -293,17 +713,103 @@ public:
 				DataType, CMP> > > pq;
 		/////priority_queue<BinaryFileBuffer<DataType,CMP> > pq;
 
+		uint64 BLOCKSIZE = requestedblocksize;
+		int runformat = requestedrunformat;
+		const string key = name + ".";
+		bool resumed = false;
+		if (checkpoint != NULL) {
+			const vector<uint64> signature = checkpoint->getNumbers(key
+					+ "signature");
+			if ((signature.size() == 4) and (signature[0] == size())
+					and (signature[1] == sizeof(DataType))) {
+				// the runs must be cut as before
+				BLOCKSIZE = signature[2];
+				runformat = static_cast<int> (signature[3]);
+				resumed = true;
+				cout << "# resuming sort from checkpoint" << endl;
+			} else {
+				checkpoint->erase(key);
+				vector<uint64> fresh;
+				fresh.push_back(size());
+				fresh.push_back(sizeof(DataType));
+				fresh.push_back(BLOCKSIZE);
+				fresh.push_back(runformat);
+				checkpoint->setNumbers(key + "signature", fresh);
+				checkpoint->save();
+			}
+			externalvector<DataType> merged;
+			if (merged.attachSorted(*checkpoint, name)) {
+				*this = std::move(merged);
+				return;
+			}
+		}
+
 		cout << "# sorting by blocks " << endl;
+		PhaseTimer rungeneration(name + ": run generation");
+		// The block shrinks to what the budget grants, but not below
+		// MINIMUMBLOCKSIZE rows; a resumed sort must cut its runs as before.
+		uint64 blockrows = BLOCKSIZE < size() ? BLOCKSIZE : size();
+		const uint64 minimumrows = resumed or (blockrows < MINIMUMBLOCKSIZE)
+				? blockrows : MINIMUMBLOCKSIZE;
+		MemoryLease blocklease(blockrows * sizeof(DataType), minimumrows
+				* sizeof(DataType));
+		if (blocklease.elements<DataType>() < blockrows) {
+			blockrows = BLOCKSIZE = blocklease.elements<DataType>();
+			if (checkpoint != NULL) {
+				vector<uint64> fresh = checkpoint->getNumbers(key + "signature");
+				fresh[2] = BLOCKSIZE;
+				checkpoint->setNumbers(key + "signature", fresh);
+				checkpoint->save();
+			}
+		}
 		const uint howmanybuffers = N / BLOCKSIZE
 				+ (N % BLOCKSIZE == 0 ? 0 : 1);
 
-		vector<vector<DataType> > buffers(howmanybuffers);// + one if for luck
-		uint buffercounter = 0;
-
-
+		// With several blocks, each sorted run goes to its own file. The
+		// spill manager spreads the runs over its directories, away from
+		// the directory we are reading from when it can.
+		vector<externalvector<DataType> > runs(howmanybuffers > 1 ? howmanybuffers : 0);
+		const bool prefixruns = (runformat == PREFIXRUNS)
+				and PrefixRunCodec<DataType>::SUPPORTED and (howmanybuffers > 1);
+		const PrefixRunCodec<DataType> codec(runColumnOrder(comparator));
+		vector<externalvector<unsigned char> > encodedruns(prefixruns ? howmanybuffers : 0);
+		vector<unsigned char> encoded;
+		uint64 encodedbytes = 0;
+		vector<uint64> runlengths;
 		vector<DataType> buffer;
-		buffer.reserve(BLOCKSIZE);
+		if (isSorted(comparator, blockrows)) {
+			cout << "# already sorted" << endl;
+			return;
+		}
+		buffer.reserve(blockrows);
+		// if the budget has room for a second block, each run is written in
+		// the background while the next block is read and sorted
+		MemoryLease overlaplease(blockrows * sizeof(DataType));
+		const bool overlapwrites = (checkpoint == NULL) and !prefixruns
+				and (howmanybuffers > 1) and (overlaplease.bytes() == blockrows
+				* sizeof(DataType));
+		if (!overlapwrites)
+			overlaplease.release();
+		IOBatch runwrites;
+		// when the sorted blocks do not overlap, the merge is a copy
+		vector<DataType> runlast;
+		bool disjointruns = !prefixruns;
+		uint64 presorted = 0;
 		for (uint64 rowindex = 0; rowindex < size(); rowindex += BLOCKSIZE) {
+			const uint64 r = rowindex / BLOCKSIZE;
+			const string runkey = key + "run." + toString(r);
+			if ((checkpoint != NULL) and checkpoint->has(runkey)) {
+				// rows, bytes
+				const vector<uint64> run = checkpoint->getNumbers(runkey);
+				runlengths.push_back(run[0]);
+				if (prefixruns)
+					encodedruns[r].attach(checkpoint->path(runkey), run[1]);
+				else
+					runs[r].attach(checkpoint->path(runkey), run[0]);
+				encodedbytes += run[1];
+				disjointruns = false;
+				continue;
+			}
 
 			cout << "# block " << (rowindex / BLOCKSIZE + 1) << " out of "
 					<< (N / BLOCKSIZE + (N % BLOCKSIZE == 0 ? 0 : 1)) << endl;
@@ -311,35 +817,122 @@ public:
 			if (rowindex + BLOCKSIZE < size())
 				end = rowindex + BLOCKSIZE;
 			loadACopy(buffer,rowindex,end);
-			std::sort(buffer.begin(), buffer.end(),comparator);
-			copyAt(buffer, rowindex);
-			BinaryFileBuffer<DataType, CMP> bfb(fd, rowindex, end, comparator,
-					buffers[buffercounter++]);
-
-			pq.push(bfb);
+			if (!adaptiveSortBlock(buffer, comparator))
+				++presorted;
+			if (howmanybuffers <= 1) {
+				if (checkpoint != NULL) {
+					// do not overwrite the input we would resume from
+					externalvector<DataType> merged;
+					merged.create(checkpoint->path(name + ".merged"));
+					merged.append(buffer);
+					merged.sync();
+					checkpoint->set(key + "done", "1");
+					checkpoint->save();
+					*this = std::move(merged);
+					return;
+				}
+				copyAt(buffer, rowindex);
+				continue;
+			}
+			runlengths.push_back(buffer.size());
+			if (disjointruns) {
+				if (!runlast.empty() and comparator(buffer.front(), runlast.back()))
+					disjointruns = false;
+				runlast.push_back(buffer.back());
+			}
+			if (prefixruns) {
+				codec.encode(&buffer[0], &buffer[0] + buffer.size(), encoded);
+				externalvector<unsigned char> & run = encodedruns[r];
+				if (checkpoint != NULL)
+					run.create(checkpoint->path(runkey));
+				else
+					run.open(encoded.size(), mSpillDir);
+				run.append(encoded);
+				encodedbytes += encoded.size();
+				if (checkpoint != NULL)
+					saveRun(*checkpoint, runkey, run, buffer.size(), encoded.size());
+				continue;
+			}
+			externalvector<DataType> & run = runs[r];
+			if (checkpoint != NULL)
+				run.create(checkpoint->path(runkey));
+			else
+				run.open(buffer.size() * sizeof(DataType), mSpillDir);
+			if (overlapwrites) {
+				run.append(std::move(buffer), runwrites);
+				runwrites.submit();
+				continue;
+			}
+			run.append(buffer);
+			if (checkpoint != NULL)
+				saveRun(*checkpoint, runkey, run, buffer.size(),
+						buffer.size() * sizeof(DataType));
 		}
-		if(buffercounter!=buffers.size())
-			throw runtime_error("This should never happen.");
-		if(howmanybuffers==1)
+		if (prefixruns)
+			cout << "# prefix-truncated runs use " << encodedbytes * 100.0
+					/ (size() * sizeof(DataType)) << "% of the space" << endl;
+		if (presorted > 0)
+			cout << "# " << presorted << " blocks were already sorted" << endl;
+		if(howmanybuffers<=1)
 			return;// we are done
-		// we must merge which requires a new file
-		char * newFileName;
-		if (getenv("TMPDIR") != NULL) {
-			newFileName = tempnam(getenv("TMPDIR"), NULL);
-			if (verbose)
-				cout << "# creating temp file " << newFileName << endl;
-		} else {
-			newFileName = tmpnam(NULL);
-			if (verbose)
-				cout << "# TMPDIR is null, creating temp file " << newFileName
+		runwrites.wait();
+		overlaplease.release();
+		rungeneration.stop();
+		PhaseTimer merging(name + ": merge");
+		vector<DataType>().swap(buffer);
+		blocklease.release();
+		const uint64 totalsize = size();
+		close();// the runs hold all the data now
+		// we must merge which requires a new file; with a checkpoint, we
+		// may pick up a partial merge (plain runs only: prefix-truncated
+		// runs can only be read from the start)
+		externalvector<DataType> merged;
+		vector<uint64> positions(runlengths.size(), 0);
+		if (checkpoint != NULL) {
+			const vector<uint64> progress = checkpoint->getNumbers(key + "merge");
+			if (!prefixruns and (progress.size() == runlengths.size() + 1)) {
+				merged.attach(checkpoint->path(name + ".merged"), progress[0]);
+				for (uint r = 0; r < runlengths.size(); ++r)
+					positions[r] = progress[r + 1];
+				cout << "# resuming merge after " << progress[0] << " elements"
 						<< endl;
+			} else
+				merged.create(checkpoint->path(name + ".merged"));
+		} else
+			merged.open(totalsize * sizeof(DataType));
+		// each reader prefetches its next chunk while the merge consumes
+		// the current one: the chunks share a lease on the budget
+		vector<PrefetchBuffer<DataType> > buffers(howmanybuffers);
+		MemoryLease mergelease(2 * howmanybuffers * MAXMERGECHUNKBYTES, 2
+				* howmanybuffers * MINMERGECHUNKBYTES);
+		for (uint r = 0; r < howmanybuffers; ++r)
+			buffers[r].chunkbytes = mergelease.bytes() / (2 * howmanybuffers);
+		if (disjointruns) {
+			cout << "# the sorted blocks do not overlap: concatenating them"
+					<< endl;
+			vector<DataType> chunk;
+			const uint64 chunkrows = mergelease.elements<DataType> ();
+			for (uint r = 0; r < runs.size(); ++r)
+				for (uint64 b = 0; b < runs[r].size(); b += chunkrows) {
+					runs[r].loadACopy(chunk, b, b + chunkrows < runs[r].size() ? b
+							+ chunkrows : runs[r].size());
+					merged.append(chunk);
+				}
 		}
-		FILE * newfd = ::fopen(newFileName, "w+b");
-		if (newfd == NULL) {
-			cerr << "Can't open " << newFileName << endl;
-			cerr << "Check your TMPDIR variable" << endl;
-			cerr << strerror(errno) << endl;
-			throw runtime_error("could not open temp file");
+		for (uint r = 0; !disjointruns and (r < runlengths.size()); ++r) {
+			if (prefixruns) {
+				encodedruns[r].flush();
+				BinaryFileBuffer<DataType, CMP> bfb(&encodedruns[r].mFile,
+						&codec, runlengths[r], encodedruns[r].size(),
+						comparator, buffers[r]);
+				pq.push(bfb);
+				continue;
+			}
+			if (positions[r] == runs[r].size())
+				continue;// exhausted before the checkpoint
+			BinaryFileBuffer<DataType, CMP> bfb(&runs[r].mFile, positions[r],
+					runs[r].size(), comparator, buffers[r]);
+			pq.push(bfb);
 		}
 
 		DataType container;
@@ -349,7 +942,10 @@ public:
 
 		cout << "#sorted all the blocks" << endl;
 		uint64 counter = 0;
+		const uint64 checkpointinterval = MERGECHECKPOINTBYTES
+				/ sizeof(DataType) + 1;
 		BinaryFileBuffer<DataType, CMP> bfb;
+		IOBatch mergewrites;// the output is written while we merge
 		while (!pq.empty()) {
 			bfb = pq.top();
 			pq.pop();
@@ -368,40 +964,80 @@ public:
 				}
 			}
 
-			size_t result = fwrite(&container, sizeof(container), 1, newfd);
-			if (result != 1) {
-				cerr << "Error appending to the file " << newFileName << endl;
-				cerr << strerror(errno) << endl;
-				break;
-			}
+			merged.append(container, mergewrites);
 			++counter;
 			if (!bfb.empty()) {
 				pq.push(bfb); // add it back
 			}
+			if ((checkpoint != NULL) and !prefixruns and (counter
+					% checkpointinterval == 0)) {
+				mergewrites.wait();
+				saveMergeProgress(*checkpoint, key, merged, pq, buffers,
+						runlengths);
+			}
 		}
-		::fclose(fd);
-		fd = newfd;
-		mFileName = newFileName;
+		mergewrites.wait();
+		merged.flush();
+		if (checkpoint != NULL) {
+			merged.sync();
+			checkpoint->set(key + "done", "1");
+			checkpoint->erase(key + "merge");
+			checkpoint->erase(key + "run.");
+			checkpoint->save();
+		}
+		for (uint r = 0; r < runs.size(); ++r)
+			runs[r].remove();
+		for (uint r = 0; r < encodedruns.size(); ++r)
+			encodedruns[r].remove();
+		*this = std::move(merged);
 	}
 
 	bool append(const DataType & d) {
-		int results = fseek(fd, 0, SEEK_END);
-		if (results != 0) {
-			cerr << "could not seek to end of file" << endl;
-			throw runtime_error("bad seek");
-		}
-		size_t result = fwrite(&d, sizeof(d), 1, fd);
-		if (result != 1) {
-			cerr << "Error appending to the file " << mFileName << endl;
-			cerr << strerror(errno) << endl;
-			return false;
-		}
+		mTail.push_back(d);
 		++N;
+		if (mTail.size() * sizeof(DataType) >= APPENDBUFFERBYTES)
+			flush();
 		return true;
 	}
 
+	// same as append, but the pending appends are written in the
+	// background, through batch, when there are enough of them
+	bool append(const DataType & d, IOBatch & batch) {
+		mTail.push_back(d);
+		++N;
+		if (mTail.size() * sizeof(DataType) >= APPENDBUFFERBYTES)
+			flush(batch);
+		return true;
+	}
+
+	// starts writing the pending appends through batch (and submits it)
+	void flush(IOBatch & batch) {
+		if (mTail.empty())
+			return;
+		vector<DataType> full;
+		full.reserve(mTail.capacity());
+		full.swap(mTail);
+		const uint64 offset = mFlushed * sizeof(DataType);
+		mFlushed += full.size();
+		batch.write(mFile, std::move(full), offset);
+		batch.submit();
+	}
+
+	// writes the pending appends to the file
+	void flush() {
+		if (mTail.empty())
+			return;
+		mFile.write(&mTail[0], mTail.size() * sizeof(DataType), mFlushed
+				* sizeof(DataType));
+		mFlushed += mTail.size();
+		mTail.clear();
+	}
+
 	// caller is responsible for calling close
-	void open() {
+	// The spill manager picks the directory: expectedbytes lets it skip
+	// directories without enough room, and it will use another directory
+	// than avoid (see spillDirectory) if it can.
+	void open(const uint64 expectedbytes = 0, const int avoid = -1) {
 		if (vverbose)
 			cout << "opening..." << endl;
 		externalvector<DataType>::NumberOfCallsToOpen += 1;
@@ -410,125 +1046,424 @@ public:
 					<< externalvector<DataType>::NumberOfCallsToOpen << endl;
 
 
-		if (getenv("TMPDIR") != NULL) {
-			mFileName = tempnam(getenv("TMPDIR"), NULL);
-			if (verbose)
-				cout << "# creating temp file " << mFileName << endl;
-		} else {
-			mFileName = tmpnam(NULL);
-			if (verbose)
-				cout << "# TMPDIR not specified, creating temp file "
-						<< mFileName << endl;
-		}
-		fd = ::fopen(mFileName, "w+b");
-		if (fd == NULL) {
+		mFileName = SpillManager::instance().createFile(mSpillDir,
+				expectedbytes, avoid);
+		mReservedBytes = expectedbytes;
+		if (verbose)
+			cout << "# creating temp file " << mFileName << endl;
+		if (!mFile.open(mFileName.c_str())) {
 			cerr << "Can't open " << mFileName << endl;
 			cerr << "Check your TMPDIR variable" << endl;
 			cerr << strerror(errno) << endl;
 			throw runtime_error("could not open temp file");
 		}
+		N = 0;
+		mFlushed = 0;
+		mTail.clear();
 		if (vverbose)
 			cout << "File " << mFileName << " is opened" << endl;
 	}
 
+	// Persistent files are named by the caller and survive close(); they
+	// hold the state of checkpointed sorts (see checkpoint.h).
+
+	// creates an empty persistent file
+	void create(const string & filename) {
+		close();
+		openNamed(filename, true);
+		N = 0;
+		mFlushed = 0;
+	}
+
+	// opens a persistent file holding numberofelements elements (anything
+	// after them is discarded)
+	void attach(const string & filename, const uint64 numberofelements) {
+		close();
+		openNamed(filename, false);
+		if (getFileSize() < static_cast<off_t> (numberofelements
+				* sizeof(DataType))) {
+			cerr << filename << " is shorter than expected" << endl;
+			close();
+			throw runtime_error("truncated persistent file");
+		}
+		mFile.resize(numberofelements * sizeof(DataType));
+		N = numberofelements;
+		mFlushed = N;
+	}
+
+	// turns a temporary file into a persistent one, moving it if needed
+	void persistAs(const string & filename) {
+		flush();
+		if (mPersistent and (filename == mFileName))
+			return;
+		if (::rename(mFileName.c_str(), filename.c_str()) != 0) {
+			// probably another file system: copy
+			externalvector<DataType> copy;
+			copy.create(filename);
+			vector<DataType> buffer;
+			const uint64 step = APPENDBUFFERBYTES / sizeof(DataType) + 1;
+			for (uint64 k = 0; k < size(); k += step) {
+				loadACopy(buffer, k, k + step < size() ? k + step : size());
+				copy.append(buffer);
+			}
+			copy.sync();
+			swap(copy);
+			copy.close();
+			return;
+		}
+		SpillManager::instance().release(mSpillDir, mReservedBytes);
+		mSpillDir = -1;
+		mReservedBytes = 0;
+		mFileName = filename;
+		mPersistent = true;
+		sync();
+	}
+
+	// flushes and makes the content durable
+	void sync() {
+		flush();
+		mFile.sync();
+	}
+
+	bool isPersistent() const {
+		return mPersistent;
+	}
+
+	// reopens the output of a checkpointed sort that completed
+	bool attachSorted(Checkpoint & checkpoint, const string & name) {
+		const vector<uint64> signature = checkpoint.getNumbers(name
+				+ ".signature");
+		if (!checkpoint.has(name + ".done") or (signature.size() != 4)
+				or (signature[1] != sizeof(DataType)))
+			return false;
+		attach(checkpoint.path(name + ".merged"), signature[0]);
+		return true;
+	}
+
+	// closes and deletes the file, even if it is persistent
+	void remove() {
+		mPersistent = false;
+		close();
+	}
+
 	void close() {
 
-		if (fd != NULL) {
+		if (mFile.isOpen()) {
 			if (vverbose)
 				cout << "closing " << mFileName << endl;
-			::fclose(fd);
-			::unlink(mFileName);
-			fd = NULL;
+			mFile.close();
+			if (!mPersistent)
+				::unlink(mFileName.c_str());
+			mPersistent = false;
+			SpillManager::instance().release(mSpillDir, mReservedBytes);
+			mSpillDir = -1;
+			mReservedBytes = 0;
 			N = 0;
+			mFlushed = 0;
+			mTail.clear();
 			assert(externalvector<DataType>::NumberOfCallsToOpen>0);
 			externalvector<DataType>::NumberOfCallsToOpen -= 1;
-			mFileName = NULL;
+			mFileName.clear();
+		}
+	}
+
+	// Whether the elements are in comparator order. We read chunks of
+	// growing size (up to maxchunk elements) and stop at the first
+	// inversion, so that checking unsorted data costs little. Each chunk
+	// after the first starts with the last element of the previous one.
+	template<class CMP>
+	bool isSorted(CMP & comparator, const uint64 maxchunk = defaultBlockSize()) const {
+		vector<DataType> chunk;
+		uint64 chunksize = SORTEDCHECKCHUNK < maxchunk ? SORTEDCHECKCHUNK : maxchunk;
+		for (uint64 begin = 0; begin < size();) {
+			const uint64 end = begin + chunksize < size() ? begin + chunksize
+					: size();
+			loadACopy(chunk, begin > 0 ? begin - 1 : begin, end);
+			if (!std::is_sorted(chunk.begin(), chunk.end(), comparator))
+				return false;
+			begin = end;
+			if (chunksize < maxchunk)
+				chunksize = 2 * chunksize < maxchunk ? 2 * chunksize : maxchunk;
 		}
+		return true;
 	}
 
 	void loadACopy(vector<DataType> & buffer, uint64 begin, uint64 end) const {
 		buffer.resize(end - begin);
-		int result = fseek(fd, begin * sizeof(DataType), SEEK_SET);
-		if (result != 0) {
-			cerr << "could not seek to " << begin << endl;
-			throw runtime_error("bad seek");
-		}
-		size_t result2 = fread(&(buffer[0]), sizeof(DataType), buffer.size(), fd);
-		if (result2 != (end-begin)) {
-			cerr << "Error reading from file " << endl;
-			cerr << strerror(errno) << endl;
+		if (end > N) {
+			cerr << "could not read up to " << end << endl;
 			throw runtime_error("bad read");
 		}
+		// the range may straddle the file and the pending appends
+		const uint64 ondisk = end < mFlushed ? end : mFlushed;
+		if (begin < ondisk)
+			mFile.read(&(buffer[0]), (ondisk - begin) * sizeof(DataType),
+					begin * sizeof(DataType));
+		for (uint64 k = ondisk > begin ? ondisk : begin; k < end; ++k)
+			buffer[k - begin] = mTail[k - mFlushed];
+	}
 
+	// same as loadACopy, but the read goes through batch (see IOBatch):
+	// buffer is only filled once the batch has been waited for, and it
+	// must not be resized until then
+	void loadACopy(vector<DataType> & buffer, uint64 begin, uint64 end,
+			IOBatch & batch) const {
+		buffer.resize(end - begin);
+		if (end > N) {
+			cerr << "could not read up to " << end << endl;
+			throw runtime_error("bad read");
+		}
+		const uint64 ondisk = end < mFlushed ? end : mFlushed;
+		if (begin < ondisk)
+			batch.read(mFile, &(buffer[0]), (ondisk - begin) * sizeof(DataType),
+					begin * sizeof(DataType));
+		for (uint64 k = ondisk > begin ? ondisk : begin; k < end; ++k)
+			buffer[k - begin] = mTail[k - mFlushed];
 	}
 
-	DataType get(const uint64 pos) {
+	DataType get(const uint64 pos) const {
 
-		    if (fd == NULL) {
+		    if (!mFile.isOpen()) {
 		    	cerr<<"no file to read from! Open the file first!"<<endl;
 				throw runtime_error("file not open");
 		    }
+			if (pos >= mFlushed)
+				return mTail[pos - mFlushed];
 			DataType ans;
-			int result =
-			fseek(fd, pos * sizeof(DataType), SEEK_SET);
-			if (result != 0) {
-						cerr << "could not seek to " << pos << endl;
-						throw runtime_error("bad seek");
-			}
-			size_t howmany =
-			fread(&ans, sizeof(DataType), 1,fd);
-			if (howmany !=  sizeof(DataType)) {
-						cerr << "Error read from file " << endl;
-						cerr << strerror(errno) << endl;
-						throw runtime_error("bad read");
-			}
+			mFile.read(&ans, sizeof(DataType), pos * sizeof(DataType));
 			return ans;
 	}
+	// same as append, but the write goes through batch (see IOBatch),
+	// which takes the rows
+	void append(vector<DataType> && buffer, IOBatch & batch) {
+		if (buffer.empty())
+			return;
+		flush();
+		const uint64 offset = mFlushed * sizeof(DataType);
+		mFlushed += buffer.size();
+		N += buffer.size();
+		batch.write(mFile, std::move(buffer), offset);
+	}
+
 	void append(const vector<DataType> & buffer) {
-		int result = fseek(fd, 0, SEEK_END);
-		if (result != 0) {
-			cerr << "could not seek to end of file" << endl;
-			throw runtime_error("bad seek");
-		}
-		size_t result2 = fwrite(&(buffer[0]), sizeof(DataType), buffer.size(), fd);
-		if (result2 != buffer.size()) {
-			cerr << "Error write from file " << endl;
-			cerr << strerror(errno) << endl;
-			throw runtime_error("bad read");
-		}
+		if (buffer.empty())
+			return;
+		flush();
+		mFile.write(&(buffer[0]), buffer.size() * sizeof(DataType), mFlushed
+				* sizeof(DataType));
+		mFlushed += buffer.size();
 		N+=buffer.size();
 
 	}
 
 	void copyAt(const vector<DataType> & buffer, uint64 begin) {
-		int result = fseek(fd, begin * sizeof(DataType), SEEK_SET);
-		if (result != 0) {
-			cerr << "could not seek to " << begin << endl;
-			throw runtime_error("bad seek");
-		}
-		size_t result2 = fwrite(&(buffer[0]), sizeof(DataType), buffer.size(), fd);
-		if (result2 != buffer.size()) {
-			cerr << "Error write from file " << endl;
-			cerr << strerror(errno) << endl;
-			throw runtime_error("bad read");
+		if (buffer.empty())
+			return;
+		if (begin + buffer.size() > mFlushed)
+			flush();
+		mFile.write(&(buffer[0]), buffer.size() * sizeof(DataType), begin
+				* sizeof(DataType));
+		if (begin + buffer.size() > N) {
+			N = begin + buffer.size();
+			mFlushed = N;
 		}
 
 	}
 
+	// same as copyAt, but the write goes through batch (see IOBatch),
+	// which takes the rows
+	void copyAt(vector<DataType> && buffer, uint64 begin, IOBatch & batch) {
+		if (buffer.empty())
+			return;
+		const uint64 end = begin + buffer.size();
+		if (end > mFlushed)
+			flush();
+		batch.write(mFile, std::move(buffer), begin * sizeof(DataType));
+		if (end > N) {
+			N = end;
+			mFlushed = N;
+		}
+	}
+
 	uint64 size() const {
 		return N;
 	}
 
+	int spillDirectory() const {
+		return mSpillDir;
+	}
+
+	// a view of [begin,end), no copy is made
+	externalrange<DataType> range(uint64 begin, uint64 end) const {
+		return externalrange<DataType> (*this, begin, end);
+	}
+
+	// keeps only the first elements, in constant time
+	void truncate(uint64 number) {
+		if (number >= N)
+			return;
+		if (number >= mFlushed) {
+			mTail.resize(number - mFlushed);
+		} else {
+			mTail.clear();
+			mFlushed = number;
+		}
+		N = number;
+	}
+
 private:
+	template<class> friend class externalvector;
+
+	void gatherRange(const vector<uint64> & sortedpositions,
+			vector<DataType> & out, uint64 b, uint64 e) const {
+		const uint64 window = sizeof(DataType) >= GATHERBYTES ? 1
+				: GATHERBYTES / sizeof(DataType);
+		vector<DataType> buffer;
+		while (b < e) {
+			const uint64 first = sortedpositions[b];
+			if (first >= mFlushed) {
+				out[b++] = get(first);
+				continue;
+			}
+			uint64 last = b;
+			while ((last + 1 < e) and (sortedpositions[last + 1] < first
+					+ window) and (sortedpositions[last + 1] < mFlushed))
+				++last;
+			const uint64 span = sortedpositions[last] - first + 1;
+			buffer.resize(span);
+			mFile.read(&buffer[0], span * sizeof(DataType), first
+					* sizeof(DataType));
+			for (; b <= last; ++b)
+				out[b] = buffer[sortedpositions[b] - first];
+		}
+	}
+
+	static string toString(const uint64 x) {
+		ostringstream out;
+		out << x;
+		return out.str();
+	}
+
+	template<class RunType>
+	static void saveRun(Checkpoint & checkpoint, const string & runkey,
+			RunType & run, const uint64 rows, const uint64 bytes) {
+		run.sync();
+		vector<uint64> info;
+		info.push_back(rows);
+		info.push_back(bytes);
+		checkpoint.setNumbers(runkey, info);
+		checkpoint.save();
+	}
+
+	// the position of each run is where its reader is, or its end if the
+	// reader is no longer in the queue
+	template<class PQ>
+	static void saveMergeProgress(Checkpoint & checkpoint, const string & key,
+			externalvector<DataType> & merged, PQ pq, vector<PrefetchBuffer<
+					DataType> > & buffers, const vector<uint64> & runlengths) {
+		merged.sync();
+		vector<uint64> progress(runlengths.size() + 1);
+		progress[0] = merged.size();
+		for (uint r = 0; r < runlengths.size(); ++r)
+			progress[r + 1] = runlengths[r];
+		for (; !pq.empty(); pq.pop())
+			progress[pq.top().buf - &buffers[0] + 1] = pq.top().currentpointer;
+		checkpoint.setNumbers(key + "merge", progress);
+		checkpoint.save();
+	}
+
+	void openNamed(const string & filename, const bool truncate) {
+		externalvector<DataType>::NumberOfCallsToOpen += 1;
+		mFileName = filename;
+		mSpillDir = -1;
+		mReservedBytes = 0;
+		mPersistent = true;
+		mTail.clear();
+		if (!mFile.open(mFileName.c_str(), BlockFile::directIORequested(),
+				truncate)) {
+			cerr << "Can't open " << mFileName << endl;
+			cerr << strerror(errno) << endl;
+			mFileName.clear();
+			mPersistent = false;
+			externalvector<DataType>::NumberOfCallsToOpen -= 1;
+			throw runtime_error("could not open persistent file");
+		}
+	}
 
-	FILE * fd; //file descriptor
+	BlockFile mFile;
 	uint64 N;
+	uint64 mFlushed;// number of elements already in the file
+	vector<DataType> mTail;// appended, not yet written
 	static uint NumberOfCallsToOpen;
-	char * mFileName;
+	string mFileName;
+	int mSpillDir;// index in SpillManager::directories()
+	uint64 mReservedBytes;
+	bool mPersistent;// not deleted by close()
 };
 
 template<class DataType>
 uint externalvector<DataType>::NumberOfCallsToOpen = 0;
 
+// A read-only window over an externalvector: (source, offset, length).
+// Creating one costs no I/O. It remains valid as long as the source
+// is open and not modified.
+template<class DataType>
+class externalrange {
+public:
+	typedef DataType value_type;
+
+	externalrange() :
+		source(NULL), mOffset(0), N(0) {
+	}
+	externalrange(const externalvector<DataType> & v) :
+		source(&v), mOffset(0), N(v.size()) {
+	}
+	externalrange(const externalvector<DataType> & v, uint64 begin,
+			uint64 end) :
+		source(&v), mOffset(begin), N(0) {
+		if (end > v.size())
+			end = v.size();
+		if (begin > end) {
+			mOffset = end;
+			begin = end;
+		}
+		N = end - begin;
+	}
+
+	void loadACopy(vector<DataType> & buffer, uint64 begin, uint64 end) const {
+		if (end > N) {
+			cerr << "could not read up to " << end << endl;
+			throw runtime_error("bad read");
+		}
+		source->loadACopy(buffer, mOffset + begin, mOffset + end);
+	}
+
+	DataType get(const uint64 pos) const {
+		return source->get(mOffset + pos);
+	}
+
+	externalrange<DataType> range(uint64 begin, uint64 end) const {
+		if (end > N)
+			end = N;
+		if (begin > end)
+			begin = end;
+		return externalrange<DataType> (*source, mOffset + begin, mOffset
+				+ end);
+	}
+
+	externalrange<DataType> top(uint64 number) const {
+		return range(0, number);
+	}
+
+	uint64 size() const {
+		return N;
+	}
+
+private:
+	const externalvector<DataType> * source;
+	uint64 mOffset;
+	uint64 N;
+};
+
 
 #endif /* EXTERNALVECTOR_H_ */
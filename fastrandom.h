@@ -0,0 +1,79 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef FASTRANDOM_H_
+#define FASTRANDOM_H_
+
+#include <algorithm>
+
+typedef unsigned int uint;
+typedef unsigned long long uint64;
+
+/**
+ * xoshiro256** seeded through splitmix64. Cheap enough that each thread
+ * (or each block) can have its own generator, and unlike rand() it covers
+ * the full 64-bit range.
+ */
+class FastRandom {
+public:
+	FastRandom(uint64 seed = 0) {
+		this->seed(seed);
+	}
+
+	// derive a generator for a given stream (thread, block, bucket...)
+	FastRandom(uint64 seed, uint64 stream) {
+		this->seed(seed ^ mix(stream + 0x632BE59BD9B4E019ULL));
+	}
+
+	void seed(uint64 seed) {
+		for (int k = 0; k < 4; ++k) {
+			seed += 0x9E3779B97F4A7C15ULL;
+			s[k] = mix(seed);
+		}
+	}
+
+	uint64 next() {
+		const uint64 answer = rotl(s[1] * 5, 7) * 9;
+		const uint64 t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return answer;
+	}
+
+	// unbiased value in [0, bound), bound > 0
+	uint64 uniform(uint64 bound) {
+		const uint64 threshold = (0 - bound) % bound;
+		while (true) {
+			const uint64 r = next();
+			if (r >= threshold)
+				return r % bound;
+		}
+	}
+
+	// unbiased Fisher-Yates shuffle
+	template<class iterator>
+	void shuffle(iterator begin, iterator end) {
+		for (uint64 k = end - begin; k > 1; --k)
+			std::iter_swap(begin + (k - 1), begin + uniform(k));
+	}
+
+	static uint64 mix(uint64 z) {
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+private:
+	static uint64 rotl(const uint64 x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+	uint64 s[4];
+};
+
+#endif /* FASTRANDOM_H_ */
@@ -129,11 +129,17 @@ class CSVFlatFile {
     	return sum;
     }
 
-    vector<uint> computeColumnOrderAndReturnColumnIndexes(int order = INCREASINGCARDINALITY) {
+    // number of distinct values per column, the codes are in [0,cardinality)
+    vector<uint> getColumnCardinalities() const {
     	vector<uint> cardinalities;
     	for(uint k = 0; k<mapping.size();++k) {
 			cardinalities.push_back(mapping[k].size());
 		}
+    	return cardinalities;
+    }
+
+    vector<uint> computeColumnOrderAndReturnColumnIndexes(int order = INCREASINGCARDINALITY) {
+    	vector<uint> cardinalities = getColumnCardinalities();
         vector<pair<uint,uint> > cardinalitiesindex;
         for(uint k = 0; k<cardinalities.size() ; ++k)
             cardinalitiesindex.push_back(pair<uint,uint>(cardinalities.at(k),k));
@@ -0,0 +1,111 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef HAMMING_H_
+#define HAMMING_H_
+
+#include <cstddef>
+#include <stdint.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+typedef unsigned int uint;
+
+/**
+ * Hamming distance between rows of codes: the number of columns where
+ * they differ. Whole vectors of columns are compared at once and the
+ * number of equal lanes is read from the popcount of the comparison mask,
+ * so there is no branch per column. We use AVX2 when the compiler targets
+ * it (e.g., -mavx2 or -march=native), SSE2 otherwise, and a plain loop for
+ * the remaining columns.
+ */
+inline uint hammingDistance(const uint * x, const uint * y, const size_t n) {
+	size_t k = 0;
+	uint equal = 0;
+#if defined(__AVX2__)
+	for (; k + 8 <= n; k += 8) {
+		const __m256i a = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i *> (x + k));
+		const __m256i b = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i *> (y + k));
+		equal += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(
+				_mm256_cmpeq_epi32(a, b))));
+	}
+#endif
+#if defined(__SSE2__)
+	for (; k + 4 <= n; k += 4) {
+		const __m128i a = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *> (x + k));
+		const __m128i b = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *> (y + k));
+		equal += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(
+				_mm_cmpeq_epi32(a, b))));
+	}
+#endif
+	for (; k < n; ++k)
+		equal += x[k] == y[k];
+	return static_cast<uint> (n) - equal;
+}
+
+/**
+ * Rows of codes below 256, one byte per column, padded with zeroes to a
+ * multiple of NARROWROWALIGNMENT bytes (see narrowStride): the padding is
+ * equal in both rows, so it does not count, and there is no scalar tail.
+ */
+enum {
+	NARROWROWALIGNMENT = 16
+};
+
+// the padded length, in columns, of a row of n codes of type Code
+template<class Code>
+size_t narrowStride(const size_t n) {
+	const size_t perblock = NARROWROWALIGNMENT / sizeof(Code);
+	return (n + perblock - 1) / perblock * perblock;
+}
+
+inline uint hammingDistance(const uint8_t * x, const uint8_t * y,
+		const size_t stride) {
+	uint different = 0;
+#if defined(__SSE2__)
+	for (size_t k = 0; k < stride; k += 16) {
+		const __m128i a = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *> (x + k));
+		const __m128i b = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *> (y + k));
+		different += 16 - __builtin_popcount(_mm_movemask_epi8(
+				_mm_cmpeq_epi8(a, b)));
+	}
+#else
+	for (size_t k = 0; k < stride; ++k)
+		different += x[k] != y[k];
+#endif
+	return different;
+}
+
+// codes below 65536, two bytes per column, padded like the byte rows
+inline uint hammingDistance(const uint16_t * x, const uint16_t * y,
+		const size_t stride) {
+	uint different = 0;
+#if defined(__SSE2__)
+	for (size_t k = 0; k < stride; k += 8) {
+		const __m128i a = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *> (x + k));
+		const __m128i b = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *> (y + k));
+		// each 16-bit lane sets two bits of the mask
+		different += 8 - __builtin_popcount(_mm_movemask_epi8(
+				_mm_cmpeq_epi16(a, b))) / 2;
+	}
+#else
+	for (size_t k = 0; k < stride; ++k)
+		different += x[k] != y[k];
+#endif
+	return different;
+}
+
+#endif /* HAMMING_H_ */
@@ -0,0 +1,381 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef INDIRECTSORT_H_
+#define INDIRECTSORT_H_
+
+#include <algorithm>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+#include "array.h"
+#include "util.h"
+#include "externalvector.h"
+#include "radixsort.h"
+
+using namespace std;
+
+/**
+ * Packs the columns of a row, in a given column order, into KEYWORDS
+ * 32-bit words so that comparing the words lexicographically compares the
+ * rows lexicographically. Each column takes bits(cardinality-1) bits;
+ * constant columns take none. Columns that do not fit are left out, in
+ * which case the key is only a prefix of the order (see isExact).
+ */
+template<int c, int KEYWORDS>
+class KeyPacker {
+public:
+	KeyPacker(const vector<uint> & indexes, const vector<uint> & cardinalities) :
+		mColumns(), mWidths(), mExact(true) {
+		uint usedbits = 0;
+		for (uint k = 0; k < indexes.size(); ++k) {
+			const uint column = indexes[k];
+			const uint card = column < cardinalities.size() ? cardinalities[column] : 0;
+			const uint width = card > 1 ? bits(card - 1) : (card == 1 ? 0 : 32);
+			if (width == 0)
+				continue;
+			if (usedbits + width > 32 * KEYWORDS) {
+				mExact = false;
+				break;
+			}
+			mColumns.push_back(column);
+			mWidths.push_back(width);
+			usedbits += width;
+		}
+	}
+
+	// true if equal keys imply equal rows (for the given order)
+	bool isExact() const {
+		return mExact;
+	}
+
+	template<class KeyType>
+	void pack(const lazyboost::array<uint, c> & row, KeyType & key) const {
+		uint64 accumulator = 0;
+		uint pendingbits = 0;
+		uint64 overflow = 0;
+		uint word = 0;
+		for (uint k = 0; k < mColumns.size(); ++k) {
+			overflow |= static_cast<uint64> (row[mColumns[k]]) >> mWidths[k];
+			accumulator = (accumulator << mWidths[k]) | row[mColumns[k]];
+			pendingbits += mWidths[k];
+			if (pendingbits >= 32) {
+				pendingbits -= 32;
+				key[word++] = static_cast<uint> (accumulator >> pendingbits);
+				accumulator &= (static_cast<uint64> (1) << pendingbits) - 1;
+			}
+		}
+		if (pendingbits > 0)
+			key[word++] = static_cast<uint> (accumulator << (32 - pendingbits));
+		for (; word < KEYWORDS; ++word)
+			key[word] = 0;
+		if (overflow != 0) {
+			cerr << "a value exceeds the cardinality of its column" << endl;
+			throw runtime_error("bad cardinalities for key packing");
+		}
+	}
+
+private:
+	vector<uint> mColumns;
+	vector<uint> mWidths;
+	bool mExact;
+};
+
+// lexicographic order over all the words of a record
+class RecordLess {
+public:
+	template<class RecordType>
+	bool operator()(const RecordType & a, const RecordType & b) const {
+		return a < b;
+	}
+};
+
+template<size_t N>
+vector<uint> identityColumnOrder() {
+	vector<uint> order(N);
+	for (uint k = 0; k < N; ++k)
+		order[k] = k;
+	return order;
+}
+
+template<size_t N>
+void sortBlock(vector<lazyboost::array<uint, N> > & buffer, RecordLess &) {
+	radixSort(buffer, identityColumnOrder<N> ());
+}
+
+/**
+ * Sorts wide rows by sorting compact records instead: each record holds
+ * the packed key (KEYWORDS words) and the row id (two words). The rows are
+ * then permuted once:
+ *
+ * 1. the records are sorted (externally);
+ * 2. each row is assigned to the output block it belongs to, by sorting
+ *    (row id, output block) pairs by row id;
+ * 3. the rows are read once and appended to the file of their output block;
+ * 4. each output block is loaded, put in order, and appended to the result.
+ *
+ * When the key cannot hold all columns, rows with equal keys are sorted
+ * with the full comparator in a last pass.
+ *
+ * With a checkpoint, the sorted records, the sorted destinations and the
+ * result are kept, so that a resumed sort only redoes steps 3 and 4.
+ */
+template<int c, int KEYWORDS, class CMP>
+class IndirectSorter {
+public:
+	typedef lazyboost::array<uint, c> row;
+	typedef lazyboost::array<uint, KEYWORDS + 2> record;
+	typedef lazyboost::array<uint, 3> destination;// row id (2 words), block
+
+	IndirectSorter(const vector<uint> & indexes,
+			const vector<uint> & cardinalities, CMP & fullcmp) :
+		mPacker(indexes, cardinalities), mCmp(fullcmp) {
+	}
+
+	void sort(externalvector<row> & data, const uint64 BLOCKSIZE =
+			externalvector<row>::defaultBlockSize(), Checkpoint * checkpoint =
+			NULL) {
+		if (data.size() == 0)
+			return;
+		if (checkpoint != NULL) {
+			externalvector<row> sorted;
+			if (sorted.attachSorted(*checkpoint, "indirect")) {
+				data = std::move(sorted);
+				return;
+			}
+		}
+		if (data.size() <= BLOCKSIZE) {
+			sortInMemory(data);
+			return;
+		}
+		const uint64 N = data.size();
+		RecordLess recordless;
+		// 1. records
+		externalvector<record> records;
+		vector<row> rows;
+		vector<record> recordbuffer;
+		if ((checkpoint == NULL) or !records.attachSorted(*checkpoint,
+				"records")) {
+			records.open(N * sizeof(record));
+			for (uint64 begin = 0; begin < N; begin += BLOCKSIZE) {
+				const uint64 end = begin + BLOCKSIZE < N ? begin + BLOCKSIZE : N;
+				data.loadACopy(rows, begin, end);
+				makeRecords(rows, begin, recordbuffer);
+				records.append(recordbuffer);
+			}
+			cout << "# sorting " << N << " keys of " << sizeof(record)
+					<< " bytes instead of rows of " << sizeof(row) << " bytes"
+					<< endl;
+			records.sort(recordless, BLOCKSIZE * (sizeof(row) / sizeof(record)),
+					defaultRunFormat(), checkpoint, "records");
+		}
+		// 2. destinations, in row order
+		externalvector<destination> destinations;
+		vector<destination> destinationbuffer;
+		if ((checkpoint == NULL) or !destinations.attachSorted(*checkpoint,
+				"destinations"))
+			sortDestinations(records, destinations, BLOCKSIZE, checkpoint);
+		// 3. distribute the rows
+		const uint64 howmanyblocks = N / BLOCKSIZE + (N % BLOCKSIZE == 0 ? 0
+				: 1);
+		vector<externalvector<row> > blocks(howmanyblocks);
+		for (uint64 b = 0; b < howmanyblocks; ++b)
+			blocks[b].open(BLOCKSIZE * sizeof(row));
+		vector<vector<row> > outgoing(howmanyblocks);
+		for (uint64 begin = 0; begin < N; begin += BLOCKSIZE) {
+			const uint64 end = begin + BLOCKSIZE < N ? begin + BLOCKSIZE : N;
+			data.loadACopy(rows, begin, end);
+			destinations.loadACopy(destinationbuffer, begin, end);
+			for (uint64 k = 0; k < rows.size(); ++k)
+				outgoing[destinationbuffer[k][2]].push_back(rows[k]);
+			for (uint64 b = 0; b < howmanyblocks; ++b) {
+				blocks[b].append(outgoing[b]);
+				outgoing[b].clear();
+			}
+		}
+		if (checkpoint == NULL)
+			destinations.close();
+		data.close();
+		data.open(N * sizeof(row));
+		// 4. put each block in order
+		vector<pair<uint64, uint> > rowidandrank;
+		vector<row> ordered;
+		for (uint64 b = 0; b < howmanyblocks; ++b) {
+			const uint64 begin = b * BLOCKSIZE;
+			const uint64 end = begin + BLOCKSIZE < N ? begin + BLOCKSIZE : N;
+			records.loadACopy(recordbuffer, begin, end);
+			rowidandrank.resize(recordbuffer.size());
+			for (uint k = 0; k < recordbuffer.size(); ++k)
+				rowidandrank[k] = make_pair(rowId(recordbuffer[k]), k);
+			std::sort(rowidandrank.begin(), rowidandrank.end());
+			// the rows arrived in increasing row id
+			blocks[b].loadACopy(rows, 0, blocks[b].size());
+			blocks[b].close();
+			ordered.resize(rows.size());
+			for (uint k = 0; k < rows.size(); ++k)
+				ordered[rowidandrank[k].second] = rows[k];
+			data.append(ordered);
+		}
+		if (checkpoint == NULL)
+			records.close();
+		if (!mPacker.isExact())
+			sortTies(data, BLOCKSIZE);
+		if (checkpoint != NULL) {
+			// same keys as a completed externalvector::sort
+			data.persistAs(checkpoint->path("indirect.merged"));
+			vector<uint64> signature;
+			signature.push_back(N);
+			signature.push_back(sizeof(row));
+			signature.push_back(BLOCKSIZE);
+			signature.push_back(PLAINRUNS);
+			checkpoint->setNumbers("indirect.signature", signature);
+			checkpoint->set("indirect.done", "1");
+			checkpoint->save();
+			records.remove();
+			destinations.remove();
+		}
+	}
+
+private:
+	void sortDestinations(externalvector<record> & records, externalvector<
+			destination> & destinations, const uint64 BLOCKSIZE,
+			Checkpoint * checkpoint) {
+		const uint64 N = records.size();
+		vector<record> recordbuffer;
+		vector<destination> destinationbuffer;
+		destinations.open(N * sizeof(destination));
+		for (uint64 begin = 0; begin < N; begin += BLOCKSIZE) {
+			const uint64 end = begin + BLOCKSIZE < N ? begin + BLOCKSIZE : N;
+			records.loadACopy(recordbuffer, begin, end);
+			destinationbuffer.resize(recordbuffer.size());
+			for (uint64 k = 0; k < recordbuffer.size(); ++k) {
+				destinationbuffer[k][0] = recordbuffer[k][KEYWORDS];
+				destinationbuffer[k][1] = recordbuffer[k][KEYWORDS + 1];
+				destinationbuffer[k][2] = static_cast<uint> ((begin + k)
+						/ BLOCKSIZE);
+			}
+			destinations.append(destinationbuffer);
+		}
+		RecordLess recordless;
+		destinations.sort(recordless, BLOCKSIZE * (sizeof(row)
+				/ sizeof(destination)), defaultRunFormat(), checkpoint,
+				"destinations");
+	}
+
+	static uint64 rowId(const record & r) {
+		return (static_cast<uint64> (r[KEYWORDS]) << 32) | r[KEYWORDS + 1];
+	}
+
+	void makeRecords(const vector<row> & rows, const uint64 firstrowid,
+			vector<record> & out) const {
+		out.resize(rows.size());
+		for (uint64 k = 0; k < rows.size(); ++k) {
+			mPacker.pack(rows[k], out[k]);
+			const uint64 rowid = firstrowid + k;
+			out[k][KEYWORDS] = static_cast<uint> (rowid >> 32);
+			out[k][KEYWORDS + 1] = static_cast<uint> (rowid);
+		}
+	}
+
+	void sortInMemory(externalvector<row> & data) {
+		vector<row> rows;
+		data.loadACopy(rows, 0, data.size());
+		vector<record> records;
+		makeRecords(rows, 0, records);
+		radixSort(records, identityColumnOrder<KEYWORDS + 2> ());
+		vector<row> ordered(rows.size());
+		for (uint64 k = 0; k < records.size(); ++k)
+			ordered[k] = rows[rowId(records[k])];
+		rows.swap(ordered);
+		if (!mPacker.isExact()) {
+			uint64 groupstart = 0;
+			record previous, current;
+			for (uint64 k = 0; k <= rows.size(); ++k) {
+				if (k < rows.size())
+					mPacker.pack(rows[k], current);
+				if ((k == rows.size()) or ((k > 0) and !sameKey(previous,
+						current))) {
+					if (k - groupstart > 1)
+						std::sort(rows.begin() + groupstart, rows.begin() + k,
+								mCmp);
+					groupstart = k;
+				}
+				previous = current;
+			}
+		}
+		data.copyAt(rows, 0);
+	}
+
+	static bool sameKey(const record & a, const record & b) {
+		for (uint k = 0; k < KEYWORDS; ++k)
+			if (a[k] != b[k])
+				return false;
+		return true;
+	}
+
+	// rows with equal keys are contiguous: sort each such group
+	void sortTies(externalvector<row> & data, const uint64 BLOCKSIZE) {
+		vector<row> rows;
+		vector<row> group;
+		externalvector<row> biggroup;// when a group does not fit in memory
+		uint64 groupstart = 0;
+		record previous, current;
+		bool first = true;
+		for (uint64 begin = 0; begin <= data.size(); begin += BLOCKSIZE) {
+			const uint64 end = begin + BLOCKSIZE < data.size() ? begin
+					+ BLOCKSIZE : data.size();
+			data.loadACopy(rows, begin, end);
+			for (uint64 k = 0; k <= rows.size(); ++k) {
+				const bool lastrow = (k == rows.size());
+				if (lastrow and (end < data.size()))
+					break;
+				if (!lastrow)
+					mPacker.pack(rows[k], current);
+				if (lastrow or (!first and !sameKey(previous, current))) {
+					flushGroup(data, groupstart, group, biggroup);
+					groupstart = begin + k;
+				}
+				if (lastrow)
+					break;
+				first = false;
+				group.push_back(rows[k]);
+				if (group.size() >= BLOCKSIZE) {
+					if (!biggroup.size())
+						biggroup.open();
+					biggroup.append(group);
+					group.clear();
+				}
+				previous = current;
+			}
+			if (end == data.size())
+				break;
+		}
+	}
+
+	void flushGroup(externalvector<row> & data, const uint64 groupstart,
+			vector<row> & group, externalvector<row> & biggroup) {
+		if (biggroup.size() > 0) {
+			biggroup.append(group);
+			group.clear();
+			biggroup.sort(mCmp);
+			for (uint64 begin = 0; begin < biggroup.size(); begin += 1048576) {
+				const uint64 end = begin + 1048576 < biggroup.size() ? begin
+						+ 1048576 : biggroup.size();
+				biggroup.loadACopy(group, begin, end);
+				data.copyAt(group, groupstart + begin);
+			}
+			biggroup.close();
+		} else if (group.size() > 1) {
+			std::sort(group.begin(), group.end(), mCmp);
+			data.copyAt(group, groupstart);
+		}
+		group.clear();
+	}
+
+	KeyPacker<c, KEYWORDS> mPacker;
+	CMP & mCmp;
+};
+
+#endif /* INDIRECTSORT_H_ */
@@ -0,0 +1,246 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef IOSTATS_H_
+#define IOSTATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+
+typedef unsigned int uint;
+typedef unsigned long long uint64;
+
+/**
+ * Process-wide I/O counters, fed by BlockFile (bytes, calls, seeks, time
+ * in pread/pwrite, bytes held in our files) and by the external sort (time
+ * spent waiting for background reads, durations of its phases).
+ *
+ * A thread is "blocked" while it is inside a read or a write, or while it
+ * waits for a prefetched chunk; for each phase, compute time is the rest.
+ * Reads done by the I/O thread pool while the merge keeps going are I/O
+ * time, but they do not block anyone.
+ */
+class IOStatistics {
+public:
+	struct Phase {
+		string name;
+		uint64 count;
+		uint64 nanoseconds;
+		uint64 blockednanoseconds;
+		uint64 bytesread;
+		uint64 byteswritten;
+	};
+
+	static IOStatistics & instance() {
+		static IOStatistics stats;
+		return stats;
+	}
+
+	static uint64 now() {
+		return chrono::duration_cast<chrono::nanoseconds>(
+				chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// time the calling thread has spent blocked on I/O so far
+	static uint64 & threadBlockedNanoseconds() {
+		static thread_local uint64 blocked = 0;
+		return blocked;
+	}
+
+	void countRead(const uint64 bytes, const uint64 nanoseconds) {
+		mBytesRead += bytes;
+		++mReadCalls;
+		mReadNanoseconds += nanoseconds;
+		threadBlockedNanoseconds() += nanoseconds;
+	}
+
+	void countWrite(const uint64 bytes, const uint64 nanoseconds) {
+		mBytesWritten += bytes;
+		++mWriteCalls;
+		mWriteNanoseconds += nanoseconds;
+		threadBlockedNanoseconds() += nanoseconds;
+	}
+
+	void countSeek() {
+		++mSeeks;
+	}
+
+	// waiting for a read issued by another thread
+	void countWait(const uint64 nanoseconds) {
+		mWaitNanoseconds += nanoseconds;
+		threadBlockedNanoseconds() += nanoseconds;
+	}
+
+	// our files grew (or shrank) on disk
+	void growFiles(const uint64 bytes) {
+		const uint64 current = (mFileBytes += bytes);
+		uint64 peak = mPeakFileBytes;
+		while ((current > peak) and !mPeakFileBytes.compare_exchange_weak(
+				peak, current))
+			;
+	}
+
+	void shrinkFiles(const uint64 bytes) {
+		mFileBytes -= bytes;
+	}
+
+	void addPhase(const Phase & p) {
+		lock_guard<mutex> lock(mMutex);
+		for (uint k = 0; k < mPhases.size(); ++k)
+			if (mPhases[k].name == p.name) {
+				mPhases[k].count += p.count;
+				mPhases[k].nanoseconds += p.nanoseconds;
+				mPhases[k].blockednanoseconds += p.blockednanoseconds;
+				mPhases[k].bytesread += p.bytesread;
+				mPhases[k].byteswritten += p.byteswritten;
+				return;
+			}
+		mPhases.push_back(p);
+	}
+
+	uint64 bytesRead() const {
+		return mBytesRead;
+	}
+	uint64 bytesWritten() const {
+		return mBytesWritten;
+	}
+	uint64 readCalls() const {
+		return mReadCalls;
+	}
+	uint64 writeCalls() const {
+		return mWriteCalls;
+	}
+	uint64 seeks() const {
+		return mSeeks;
+	}
+	uint64 readNanoseconds() const {
+		return mReadNanoseconds;
+	}
+	uint64 writeNanoseconds() const {
+		return mWriteNanoseconds;
+	}
+	uint64 waitNanoseconds() const {
+		return mWaitNanoseconds;
+	}
+	uint64 fileBytes() const {
+		return mFileBytes;
+	}
+	uint64 peakFileBytes() const {
+		return mPeakFileBytes;
+	}
+	vector<Phase> phases() const {
+		lock_guard<mutex> lock(mMutex);
+		return mPhases;
+	}
+
+	// zeroes the counters, except for the bytes currently in our files
+	void reset() {
+		mBytesRead = 0;
+		mBytesWritten = 0;
+		mReadCalls = 0;
+		mWriteCalls = 0;
+		mSeeks = 0;
+		mReadNanoseconds = 0;
+		mWriteNanoseconds = 0;
+		mWaitNanoseconds = 0;
+		mPeakFileBytes = mFileBytes.load();
+		lock_guard<mutex> lock(mMutex);
+		mPhases.clear();
+	}
+
+	void print(ostream & out) const {
+		const double MB = 1024.0 * 1024.0;
+		out << "# io: read " << bytesRead() / MB << " MB in " << readCalls()
+				<< " calls (" << readNanoseconds() * 1e-9 << " s), wrote "
+				<< bytesWritten() / MB << " MB in " << writeCalls()
+				<< " calls (" << writeNanoseconds() * 1e-9 << " s), "
+				<< seeks() << " seeks" << endl;
+		out << "# io: waited " << waitNanoseconds() * 1e-9
+				<< " s for prefetched reads, temporary files peaked at "
+				<< peakFileBytes() / MB << " MB" << endl;
+		const vector<Phase> p = phases();
+		for (uint k = 0; k < p.size(); ++k) {
+			const double seconds = p[k].nanoseconds * 1e-9;
+			const double blocked = p[k].blockednanoseconds * 1e-9;
+			out << "# phase " << p[k].name << " (x" << p[k].count << "): "
+					<< seconds << " s, blocked on I/O " << blocked
+					<< " s, compute " << (seconds > blocked ? seconds - blocked
+					: 0) << " s, read " << p[k].bytesread / MB
+					<< " MB, wrote " << p[k].byteswritten / MB << " MB" << endl;
+		}
+	}
+
+private:
+	IOStatistics() :
+		mBytesRead(0), mBytesWritten(0), mReadCalls(0), mWriteCalls(0),
+				mSeeks(0), mReadNanoseconds(0), mWriteNanoseconds(0),
+				mWaitNanoseconds(0), mFileBytes(0), mPeakFileBytes(0),
+				mPhases(), mMutex() {
+	}
+	IOStatistics(const IOStatistics &);
+	IOStatistics & operator=(const IOStatistics &);
+
+	atomic<uint64> mBytesRead;
+	atomic<uint64> mBytesWritten;
+	atomic<uint64> mReadCalls;
+	atomic<uint64> mWriteCalls;
+	atomic<uint64> mSeeks;
+	atomic<uint64> mReadNanoseconds;
+	atomic<uint64> mWriteNanoseconds;
+	atomic<uint64> mWaitNanoseconds;
+	atomic<uint64> mFileBytes;
+	atomic<uint64> mPeakFileBytes;
+	vector<Phase> mPhases;
+	mutable mutex mMutex;
+};
+
+// times a phase, from construction to stop() or destruction
+class PhaseTimer {
+public:
+	PhaseTimer(const string & name) :
+		mName(name), mStart(IOStatistics::now()), mBlocked(
+				IOStatistics::threadBlockedNanoseconds()), mRead(
+				IOStatistics::instance().bytesRead()), mWritten(
+				IOStatistics::instance().bytesWritten()), mRunning(true) {
+	}
+	~PhaseTimer() {
+		stop();
+	}
+
+	void stop() {
+		if (!mRunning)
+			return;
+		mRunning = false;
+		IOStatistics & stats = IOStatistics::instance();
+		IOStatistics::Phase p;
+		p.name = mName;
+		p.count = 1;
+		p.nanoseconds = IOStatistics::now() - mStart;
+		p.blockednanoseconds = IOStatistics::threadBlockedNanoseconds()
+				- mBlocked;
+		p.bytesread = stats.bytesRead() - mRead;
+		p.byteswritten = stats.bytesWritten() - mWritten;
+		stats.addPhase(p);
+	}
+
+private:
+	PhaseTimer(const PhaseTimer &);
+	PhaseTimer & operator=(const PhaseTimer &);
+
+	string mName;
+	uint64 mStart;
+	uint64 mBlocked;
+	uint64 mRead;
+	uint64 mWritten;
+	bool mRunning;
+};
+
+#endif /* IOSTATS_H_ */
@@ -0,0 +1,298 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef IOURING_H_
+#define IOURING_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+// IORING_OP_READ and IORING_OP_WRITE came with the 5.6 headers, as did
+// IORING_FEAT_RW_CUR_POS: older headers have the ring but not these
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) \
+	&& defined(IORING_FEAT_RW_CUR_POS)
+#define ROWREORDER_IOURING 1
+#endif
+#endif
+#endif
+
+using namespace std;
+
+typedef unsigned int uint;
+typedef unsigned long long uint64;
+
+// one positional read or write; result is the number of bytes
+// transferred, or -errno
+struct IORequest {
+	int fd;
+	char * data;
+	size_t bytes;
+	uint64 offset;
+	bool write;
+	long long result;
+};
+
+/**
+ * A minimal io_uring (Linux 5.6 and later), set up with raw system calls:
+ * requests are placed in the submission ring and we reap their results
+ * from the completion ring, so that many reads and writes are in flight
+ * with one system call. create() returns NULL when io_uring is not
+ * available (other systems, old kernels, seccomp policies) or when the
+ * environment variable ROWREORDER_IOURING is "0"; callers then use
+ * pread/pwrite.
+ *
+ * A ring is not thread-safe: use forThisThread(), or one ring per object.
+ */
+class IOUring {
+public:
+	enum {
+		DEPTH = 64
+	};
+
+	static bool enabled() {
+		const char * v = getenv("ROWREORDER_IOURING");
+		return (v == NULL) or (strcmp(v, "0") != 0);
+	}
+
+	static IOUring * create(const uint entries = DEPTH) {
+#ifdef ROWREORDER_IOURING
+		if (!enabled())
+			return NULL;
+		unique_ptr<IOUring> ring(new IOUring());
+		if (!ring->setup(entries))
+			return NULL;
+		return ring.release();
+#else
+		(void) entries;
+		return NULL;
+#endif
+	}
+
+	// the ring of the calling thread, set up on first use (NULL if none)
+	static IOUring * forThisThread() {
+		static thread_local bool tried = false;
+		static thread_local unique_ptr<IOUring> ring;
+		if (!tried) {
+			tried = true;
+			ring.reset(create());
+		}
+		return ring.get();
+	}
+
+	~IOUring() {
+#ifdef ROWREORDER_IOURING
+		if (mSQEs != NULL)
+			munmap(mSQEs, mSQEBytes);
+		if ((mCQRing != NULL) and (mCQRing != mSQRing))
+			munmap(mCQRing, mCQRingBytes);
+		if (mSQRing != NULL)
+			munmap(mSQRing, mSQRingBytes);
+		if (mFd >= 0)
+			::close(mFd);
+#endif
+	}
+
+	// starts the requests; as many as the ring holds go out at once
+	void start(IORequest * requests, const size_t howmany) {
+		mRequests = requests;
+		mHowMany = howmany;
+		mNext = 0;
+		pump(false);
+	}
+
+	// waits until all the requests given to start have completed
+	void finish() {
+		while ((mNext < mHowMany) or (mInFlight > 0))
+			pump(true);
+		mRequests = NULL;
+		mHowMany = 0;
+		mNext = 0;
+	}
+
+	void run(IORequest * requests, const size_t howmany) {
+		start(requests, howmany);
+		finish();
+	}
+
+private:
+	IOUring() :
+		mFd(-1), mSQRing(NULL), mCQRing(NULL), mSQEs(NULL), mSQRingBytes(0),
+				mCQRingBytes(0), mSQEBytes(0), mEntries(0), mInFlight(0),
+				mUnsubmitted(0), mRequests(NULL), mHowMany(0), mNext(0),
+				mSQHead(NULL), mSQTail(NULL), mSQMask(NULL), mSQArray(NULL),
+				mCQHead(NULL), mCQTail(NULL), mCQMask(NULL), mCQEs(NULL) {
+	}
+	IOUring(const IOUring &);
+	IOUring & operator=(const IOUring &);
+
+#ifdef ROWREORDER_IOURING
+	bool setup(const uint entries) {
+		struct io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		mFd = static_cast<int> (syscall(__NR_io_uring_setup, entries, &p));
+		if (mFd < 0)
+			return false;
+		mEntries = p.sq_entries;
+		mSQRingBytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		mCQRingBytes = p.cq_off.cqes + p.cq_entries
+				* sizeof(struct io_uring_cqe);
+		const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single and (mCQRingBytes > mSQRingBytes))
+			mSQRingBytes = mCQRingBytes;
+		mSQRing = mmap(NULL, mSQRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED
+				| MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+		if (mSQRing == MAP_FAILED) {
+			mSQRing = NULL;
+			return false;
+		}
+		if (single)
+			mCQRing = mSQRing;
+		else {
+			mCQRing = mmap(NULL, mCQRingBytes, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING);
+			if (mCQRing == MAP_FAILED) {
+				mCQRing = NULL;
+				return false;
+			}
+		}
+		mSQEBytes = p.sq_entries * sizeof(struct io_uring_sqe);
+		void * sqes = mmap(NULL, mSQEBytes, PROT_READ | PROT_WRITE, MAP_SHARED
+				| MAP_POPULATE, mFd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+			return false;
+		mSQEs = sqes;
+		char * sq = reinterpret_cast<char *> (mSQRing);
+		char * cq = reinterpret_cast<char *> (mCQRing);
+		mSQHead = reinterpret_cast<unsigned *> (sq + p.sq_off.head);
+		mSQTail = reinterpret_cast<unsigned *> (sq + p.sq_off.tail);
+		mSQMask = reinterpret_cast<unsigned *> (sq + p.sq_off.ring_mask);
+		mSQArray = reinterpret_cast<unsigned *> (sq + p.sq_off.array);
+		mCQHead = reinterpret_cast<unsigned *> (cq + p.cq_off.head);
+		mCQTail = reinterpret_cast<unsigned *> (cq + p.cq_off.tail);
+		mCQMask = reinterpret_cast<unsigned *> (cq + p.cq_off.ring_mask);
+		mCQEs = cq + p.cq_off.cqes;
+		return true;
+	}
+
+	// queues what fits, submits, and reaps what has completed (waiting
+	// for at least one completion if wait is set)
+	void pump(const bool wait) {
+		struct io_uring_sqe * sqes =
+				reinterpret_cast<struct io_uring_sqe *> (mSQEs);
+		unsigned tail = *mSQTail;
+		while ((mNext < mHowMany) and (mInFlight + mUnsubmitted < mEntries)) {
+			const IORequest & r = mRequests[mNext];
+			const unsigned index = tail & *mSQMask;
+			struct io_uring_sqe & sqe = sqes[index];
+			memset(&sqe, 0, sizeof(sqe));
+			sqe.opcode = r.write ? IORING_OP_WRITE : IORING_OP_READ;
+			sqe.fd = r.fd;
+			sqe.addr = reinterpret_cast<uintptr_t> (r.data);
+			sqe.len = static_cast<unsigned> (r.bytes);
+			sqe.off = r.offset;
+			sqe.user_data = mNext;
+			mSQArray[index] = index;
+			++tail;
+			++mNext;
+			++mUnsubmitted;
+		}
+		__atomic_store_n(mSQTail, tail, __ATOMIC_RELEASE);
+		const bool waiting = wait and (mInFlight + mUnsubmitted > 0)
+				and !completionsReady();
+		if ((mUnsubmitted > 0) or waiting) {
+			const long submitted = syscall(__NR_io_uring_enter, mFd,
+					mUnsubmitted, waiting ? 1 : 0, waiting
+							? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+			if (submitted > 0) {
+				mUnsubmitted -= static_cast<uint> (submitted);
+				mInFlight += static_cast<uint> (submitted);
+			} else if ((submitted < 0) and (errno != EINTR) and (errno
+					!= EAGAIN) and (errno != EBUSY))
+				abandon(-errno);
+		}
+		reap();
+	}
+
+	bool completionsReady() const {
+		return __atomic_load_n(mCQTail, __ATOMIC_ACQUIRE) != *mCQHead;
+	}
+
+	void reap() {
+		unsigned head = *mCQHead;
+		const unsigned tail = __atomic_load_n(mCQTail, __ATOMIC_ACQUIRE);
+		const struct io_uring_cqe * cqes =
+				reinterpret_cast<const struct io_uring_cqe *> (mCQEs);
+		while (head != tail) {
+			const struct io_uring_cqe & cqe = cqes[head & *mCQMask];
+			mRequests[cqe.user_data].result = cqe.res;
+			--mInFlight;
+			++head;
+		}
+		__atomic_store_n(mCQHead, head, __ATOMIC_RELEASE);
+	}
+
+	// the kernel refused to take the requests: report them as failed (the
+	// callers then do them with pread/pwrite)
+	void abandon(const int error) {
+		while (mInFlight > 0) {
+			const long r = syscall(__NR_io_uring_enter, mFd, 0, 1,
+					IORING_ENTER_GETEVENTS, NULL, 0);
+			reap();
+			if ((r < 0) and (errno != EINTR))
+				break;
+		}
+		const uint64 first = mNext - mUnsubmitted;
+		for (uint64 k = first; k < mHowMany; ++k)
+			mRequests[k].result = error;
+		// take back the entries the kernel did not consume
+		__atomic_store_n(mSQTail, *mSQHead, __ATOMIC_RELEASE);
+		mUnsubmitted = 0;
+		mInFlight = 0;
+		mNext = mHowMany;
+	}
+#else
+	bool setup(const uint) {
+		return false;
+	}
+	void pump(const bool) {
+		for (; mNext < mHowMany; ++mNext)
+			mRequests[mNext].result = -ENOSYS;
+	}
+#endif
+
+	int mFd;
+	void * mSQRing;
+	void * mCQRing;
+	void * mSQEs;
+	size_t mSQRingBytes;
+	size_t mCQRingBytes;
+	size_t mSQEBytes;
+	uint mEntries;
+	uint mInFlight;
+	uint mUnsubmitted;
+	IORequest * mRequests;
+	uint64 mHowMany;
+	uint64 mNext;
+	unsigned * mSQHead;
+	unsigned * mSQTail;
+	unsigned * mSQMask;
+	unsigned * mSQArray;
+	unsigned * mCQHead;
+	unsigned * mCQTail;
+	unsigned * mCQMask;
+	void * mCQEs;
+};
+
+#endif /* IOURING_H_ */
@@ -0,0 +1,180 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef MEMORYGOVERNOR_H_
+#define MEMORYGOVERNOR_H_
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#include <mutex>
+#include <stdexcept>
+#include <iostream>
+
+using namespace std;
+
+typedef unsigned int uint;
+typedef unsigned long long uint64;
+
+/**
+ * One memory budget for the whole process. The budget is taken from
+ * ROWREORDER_MEMORY (e.g., 512M or 4G), or else it is half of the memory
+ * of the machine or of the container (cgroup limit), whichever is less.
+ * Subsystems lease their large buffers (sort blocks, merge buffers,
+ * transposition buffers) from it, so that a run fills but does not exceed
+ * the budget.
+ */
+class MemoryGovernor {
+public:
+	enum {
+		MINIMUMBUDGET = 16 * 1024 * 1024
+	};
+
+	static MemoryGovernor & instance() {
+		static MemoryGovernor governor;
+		return governor;
+	}
+
+	void setBudget(const uint64 bytes) {
+		lock_guard<mutex> lock(mMutex);
+		mBudget = bytes < MINIMUMBUDGET ? MINIMUMBUDGET : bytes;
+	}
+
+	uint64 budget() const {
+		return mBudget;
+	}
+
+	uint64 leased() const {
+		lock_guard<mutex> lock(mMutex);
+		return mLeased;
+	}
+
+	uint64 available() const {
+		lock_guard<mutex> lock(mMutex);
+		return mBudget > mLeased ? mBudget - mLeased : 0;
+	}
+
+	/**
+	 * Grants up to wanted bytes, but never less than minimum (even if it
+	 * means going over budget). Give the result back with release().
+	 */
+	uint64 acquire(const uint64 wanted, const uint64 minimum = 0) {
+		lock_guard<mutex> lock(mMutex);
+		const uint64 left = mBudget > mLeased ? mBudget - mLeased : 0;
+		uint64 granted = wanted < left ? wanted : left;
+		if (granted < minimum)
+			granted = minimum < wanted ? minimum : wanted;
+		mLeased += granted;
+		return granted;
+	}
+
+	void release(const uint64 bytes) {
+		lock_guard<mutex> lock(mMutex);
+		mLeased = mLeased > bytes ? mLeased - bytes : 0;
+	}
+
+	// sizes such as 1048576, 512K, 256M or 4G
+	static uint64 parseSize(const string & s) {
+		char * end = NULL;
+		const double value = strtod(s.c_str(), &end);
+		uint64 unit = 1;
+		if ((end != NULL) and (*end != '\0')) {
+			switch (*end) {
+			case 'k':
+			case 'K':
+				unit = 1024ULL;
+				break;
+			case 'm':
+			case 'M':
+				unit = 1024ULL * 1024;
+				break;
+			case 'g':
+			case 'G':
+				unit = 1024ULL * 1024 * 1024;
+				break;
+			case 't':
+			case 'T':
+				unit = 1024ULL * 1024 * 1024 * 1024;
+				break;
+			default:
+				unit = 0;
+			}
+			if ((unit != 0) and (end[1] != '\0') and !(((end[1] == 'b')
+					or (end[1] == 'B')) and (end[2] == '\0')))
+				unit = 0;
+		}
+		if ((end == s.c_str()) or (unit == 0) or (value <= 0)) {
+			cerr << "can't parse memory size " << s << endl;
+			throw runtime_error("bad memory size");
+		}
+		return static_cast<uint64> (value * unit);
+	}
+
+	// physical memory, or the cgroup limit if it is lower
+	static uint64 systemMemory() {
+		uint64 answer = static_cast<uint64> (sysconf(_SC_PHYS_PAGES))
+				* static_cast<uint64> (sysconf(_SC_PAGE_SIZE));
+		const char * limits[] = { "/sys/fs/cgroup/memory.max",
+				"/sys/fs/cgroup/memory/memory.limit_in_bytes" };
+		for (uint k = 0; k < 2; ++k) {
+			ifstream in(limits[k]);
+			uint64 limit;
+			if ((in >> limit) and (limit > 0) and (limit < answer))
+				answer = limit;
+		}
+		return answer;
+	}
+
+private:
+	MemoryGovernor() :
+		mBudget(0), mLeased(0), mMutex() {
+		const char * v = getenv("ROWREORDER_MEMORY");
+		if ((v != NULL) and (*v != '\0'))
+			setBudget(parseSize(v));
+		else
+			setBudget(systemMemory() / 2);
+	}
+	MemoryGovernor(const MemoryGovernor &);
+	MemoryGovernor & operator=(const MemoryGovernor &);
+
+	uint64 mBudget;
+	uint64 mLeased;
+	mutable mutex mMutex;
+};
+
+// a lease on the memory budget, given back when it goes out of scope
+class MemoryLease {
+public:
+	MemoryLease(const uint64 wanted, const uint64 minimum = 0) :
+		mBytes(MemoryGovernor::instance().acquire(wanted, minimum)) {
+	}
+	~MemoryLease() {
+		release();
+	}
+
+	uint64 bytes() const {
+		return mBytes;
+	}
+
+	// how many elements of type T fit in the lease (at least one)
+	template<class T>
+	uint64 elements() const {
+		return mBytes < sizeof(T) ? 1 : mBytes / sizeof(T);
+	}
+
+	void release() {
+		MemoryGovernor::instance().release(mBytes);
+		mBytes = 0;
+	}
+
+private:
+	MemoryLease(const MemoryLease &);
+	MemoryLease & operator=(const MemoryLease &);
+
+	uint64 mBytes;
+};
+
+#endif /* MEMORYGOVERNOR_H_ */
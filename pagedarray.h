@@ -0,0 +1,208 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef PAGEDARRAY_H_
+#define PAGEDARRAY_H_
+
+#include <vector>
+#include <stdexcept>
+#include <iostream>
+#include "externalvector.h"
+
+using namespace std;
+
+typedef unsigned int uint;
+typedef unsigned long long uint64;
+
+/**
+ * Random access to an externalvector through a cache of small pages
+ * (about PAGEBYTES each). Before touching elements, the caller hands their
+ * positions to fetch(), which queues the reads of the missing pages in a
+ * batch (see IOBatch), together with the write-backs of the dirty pages
+ * they evict; the caller then submits and waits for the batch. The pages
+ * of the positions given to the last fetch stay in the cache until the
+ * next one, so the cache needs as many pages as a fetch may name. When
+ * the whole array fits, it is read at once. There is no prefetching: a
+ * fetch only brings in the pages it names.
+ *
+ * Elements are read with get() and changed with modify(); flush() writes
+ * back the dirty pages (they are dropped otherwise). The array must not be
+ * touched otherwise while the cache is in use.
+ */
+template<class DataType>
+class PagedArray {
+public:
+	enum {
+		PAGEBYTES = 4096, WHOLEREADBYTES = 1048576
+	};
+
+	PagedArray(externalvector<DataType> & array, const uint64 cachebytes) :
+		mArray(array), mPageBits(0), mPages(0), mSlots(), mSlotPage(),
+				mSlotDirty(), mSlotUsed(), mSlotStamp(), mPageSlot(), mHand(0),
+				mStamp(0), mMisses(0) {
+		while ((sizeof(DataType) << (mPageBits + 1)) <= PAGEBYTES)
+			++mPageBits;
+		mPages = (array.size() + pageSize() - 1) >> mPageBits;
+		mPageSlot.assign(mPages, NOSLOT);
+		uint64 slots = cachebytes / (pageSize() * sizeof(DataType));
+		if (slots > mPages)
+			slots = mPages;
+		mSlots.resize(slots);
+		mSlotPage.assign(slots, NOSLOT);
+		mSlotDirty.assign(slots, false);
+		mSlotUsed.assign(slots, false);
+		mSlotStamp.assign(slots, 0);
+		if (slots == mPages)
+			loadEverything();
+	}
+
+	// elements per page
+	uint64 pageSize() const {
+		return static_cast<uint64> (1) << mPageBits;
+	}
+
+	// how many pages a fetch may name
+	uint64 capacity() const {
+		return mSlots.size();
+	}
+
+	/**
+	 * Makes sure the pages of these positions are in the cache: the reads
+	 * (and the write-backs of evicted pages) are queued in batch, and the
+	 * elements can be used once the caller has submitted and waited for it.
+	 */
+	void fetch(const vector<uint64> & positions, IOBatch & batch) {
+		++mStamp;
+		// the cached pages named here are stamped before anything is
+		// evicted: a dirty page written back and read again in the same
+		// batch could come back stale, as the batch does not order requests
+		for (uint64 k = 0; k < positions.size(); ++k) {
+			const uint64 slot = mPageSlot[positions[k] >> mPageBits];
+			if (slot != NOSLOT) {
+				mSlotUsed[slot] = true;
+				mSlotStamp[slot] = mStamp;
+			}
+		}
+		for (uint64 k = 0; k < positions.size(); ++k) {
+			const uint64 page = positions[k] >> mPageBits;
+			uint64 slot = mPageSlot[page];
+			if (slot == NOSLOT) {
+				slot = evict(batch);
+				++mMisses;
+				mSlotPage[slot] = page;
+				mPageSlot[page] = slot;
+				const uint64 begin = page << mPageBits;
+				const uint64 end = begin + pageSize() < mArray.size() ? begin
+						+ pageSize() : mArray.size();
+				mArray.loadACopy(mSlots[slot], begin, end, batch);
+			}
+			mSlotUsed[slot] = true;
+			mSlotStamp[slot] = mStamp;
+		}
+	}
+
+	const DataType & get(const uint64 pos) const {
+		const uint64 slot = mPageSlot[pos >> mPageBits];
+		return mSlots[slot][pos & (pageSize() - 1)];
+	}
+
+	DataType & modify(const uint64 pos) {
+		const uint64 slot = mPageSlot[pos >> mPageBits];
+		mSlotDirty[slot] = true;
+		return mSlots[slot][pos & (pageSize() - 1)];
+	}
+
+	// writes back the dirty pages
+	void flush() {
+		for (uint64 slot = 0; slot < mSlots.size(); ++slot)
+			if (mSlotDirty[slot]) {
+				mArray.copyAt(mSlots[slot], mSlotPage[slot] << mPageBits);
+				mSlotDirty[slot] = false;
+			}
+	}
+
+	// pages read on demand
+	uint64 misses() const {
+		return mMisses;
+	}
+
+private:
+	enum {
+		NOSLOT = ~0ULL
+	};
+	PagedArray(const PagedArray &);
+	PagedArray & operator=(const PagedArray &);
+
+	// a slot for a new page: an empty one, or (clock) one not named by the
+	// current fetch and not used since the hand last passed
+	uint64 evict(IOBatch & batch) {
+		if (mSlots.empty())
+			throw runtime_error("the page cache is too small");
+		for (uint64 tries = 0;; ++tries) {
+			const uint64 slot = mHand;
+			mHand = (mHand + 1 == mSlots.size()) ? 0 : mHand + 1;
+			if (mSlotPage[slot] == NOSLOT)
+				return slot;
+			if (mSlotStamp[slot] == mStamp) {
+				if (tries > 2 * mSlots.size()) {
+					cerr << "a fetch names more than " << mSlots.size()
+							<< " pages" << endl;
+					throw runtime_error("the page cache is too small");
+				}
+				continue;
+			}
+			if (mSlotUsed[slot]) {
+				mSlotUsed[slot] = false;
+				continue;
+			}
+			if (mSlotDirty[slot]) {
+				// the batch takes the page, the slot gets a new one
+				mArray.copyAt(std::move(mSlots[slot]), mSlotPage[slot]
+						<< mPageBits, batch);
+				mSlots[slot] = vector<DataType> ();
+				mSlotDirty[slot] = false;
+			}
+			mPageSlot[mSlotPage[slot]] = NOSLOT;
+			mSlotPage[slot] = NOSLOT;
+			return slot;
+		}
+	}
+
+	void loadEverything() {
+		vector<DataType> buffer;
+		const uint64 pagesperread = WHOLEREADBYTES / (pageSize()
+				* sizeof(DataType)) + 1;
+		for (uint64 page = 0; page < mPages; page += pagesperread) {
+			const uint64 begin = page << mPageBits;
+			const uint64 end = begin + (pagesperread << mPageBits)
+					< mArray.size() ? begin + (pagesperread << mPageBits)
+					: mArray.size();
+			mArray.loadACopy(buffer, begin, end);
+			for (uint64 p = page; (p < mPages) and (p < page + pagesperread); ++p) {
+				const uint64 from = (p << mPageBits) - begin;
+				const uint64 to = from + pageSize() < buffer.size() ? from
+						+ pageSize() : buffer.size();
+				mSlots[p].assign(buffer.begin() + from, buffer.begin() + to);
+				mSlotPage[p] = p;
+				mPageSlot[p] = p;
+			}
+		}
+	}
+
+	externalvector<DataType> & mArray;
+	uint mPageBits;
+	uint64 mPages;
+	vector<vector<DataType> > mSlots;
+	vector<uint64> mSlotPage;
+	vector<bool> mSlotDirty;
+	vector<bool> mSlotUsed;
+	vector<uint64> mSlotStamp;
+	vector<uint64> mPageSlot;
+	uint64 mHand;
+	uint64 mStamp;
+	uint64 mMisses;
+};
+
+#endif /* PAGEDARRAY_H_ */
@@ -0,0 +1,108 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef PREFIXRUNS_H_
+#define PREFIXRUNS_H_
+
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <stdexcept>
+
+using namespace std;
+
+typedef unsigned int uint;
+typedef unsigned long long uint64;
+
+/**
+ * Compact format for sorted runs. A row is seen as a sequence of 32-bit
+ * words, visited in a given column order (the comparator's). Each row is
+ * stored as one byte giving how many leading columns it shares with the
+ * previous row, followed by the remaining columns. In a sorted run the
+ * leading columns change rarely, so most rows only store a short suffix.
+ */
+template<class DataType>
+class PrefixRunCodec {
+public:
+	enum {
+		WORDS = sizeof(DataType) / sizeof(uint32_t),
+		SUPPORTED = (sizeof(DataType) % sizeof(uint32_t) == 0) and (WORDS > 1)
+				and (WORDS < 256),
+		MAXROWBYTES = 1 + sizeof(DataType)
+	};
+
+	// columns missing from columnorder are visited last, in storage order
+	PrefixRunCodec(const vector<uint> & columnorder) :
+		mOrder() {
+		vector<bool> seen(WORDS, false);
+		for (uint k = 0; k < columnorder.size(); ++k)
+			if ((columnorder[k] < WORDS) and !seen[columnorder[k]]) {
+				seen[columnorder[k]] = true;
+				mOrder.push_back(columnorder[k]);
+			}
+		for (uint k = 0; k < WORDS; ++k)
+			if (!seen[k])
+				mOrder.push_back(k);
+	}
+
+	void encode(const DataType * begin, const DataType * end, vector<
+			unsigned char> & out) const {
+		out.resize((end - begin) * MAXROWBYTES);
+		unsigned char * p = out.empty() ? NULL : &out[0];
+		uint32_t previous[WORDS + 1], current[WORDS + 1];
+		for (const DataType * i = begin; i != end; ++i) {
+			memcpy(current, i, sizeof(DataType));
+			uint shared = 0;
+			if (i != begin)
+				while ((shared < WORDS) and (current[mOrder[shared]]
+						== previous[mOrder[shared]]))
+					++shared;
+			*p++ = static_cast<unsigned char> (shared);
+			for (uint k = shared; k < WORDS; ++k) {
+				memcpy(p, &current[mOrder[k]], sizeof(uint32_t));
+				p += sizeof(uint32_t);
+			}
+			memcpy(previous, current, sizeof(DataType));
+		}
+		out.resize(p - (out.empty() ? NULL : &out[0]));
+	}
+
+	/**
+	 * Decodes up to maxrows complete rows from in[0,length) and appends
+	 * them to out. previous must hold the row decoded just before (it is
+	 * ignored for the first row of a run, which is stored in full) and is
+	 * updated. Returns the number of bytes consumed.
+	 */
+	size_t decode(const unsigned char * in, size_t length, uint64 maxrows,
+			DataType & previous, vector<DataType> & out) const {
+		const unsigned char * p = in;
+		const unsigned char * const end = in + length;
+		uint32_t words[WORDS + 1];
+		memcpy(words, &previous, sizeof(DataType));
+		while ((maxrows > 0) and (p < end)) {
+			const uint shared = *p;
+			if (shared > WORDS)
+				throw runtime_error("corrupted prefix-truncated run");
+			const size_t rowbytes = 1 + (WORDS - shared) * sizeof(uint32_t);
+			if (static_cast<size_t> (end - p) < rowbytes)
+				break;// incomplete row
+			++p;
+			for (uint k = shared; k < WORDS; ++k) {
+				memcpy(&words[mOrder[k]], p, sizeof(uint32_t));
+				p += sizeof(uint32_t);
+			}
+			out.resize(out.size() + 1);
+			memcpy(&out.back(), words, sizeof(DataType));
+			--maxrows;
+		}
+		memcpy(&previous, words, sizeof(DataType));
+		return p - in;
+	}
+
+private:
+	vector<uint> mOrder;
+};
+
+#endif /* PREFIXRUNS_H_ */
@@ -0,0 +1,153 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef RADIXSORT_H_
+#define RADIXSORT_H_
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+typedef unsigned int uint;
+typedef unsigned long long uint64;
+
+/**
+ * In-place MSD radix sort (American flag sort) of rows of integer codes,
+ * in the lexicographic order given by a list of columns. At each step, the
+ * digit is the value of the current column minus its smallest value in the
+ * bucket; when the range of values is too large for one counting pass, the
+ * high bits are used first and the bucket is sorted again on the same
+ * column. Small buckets are left to std::sort.
+ *
+ * RowType must provide operator[] returning the value of a column.
+ */
+template<class RowType>
+class RadixSorter {
+public:
+	enum {
+		SMALLBUCKET = 64, MAXDIGITBITS = 16, MINDIGITBITS = 8
+	};
+
+	RadixSorter(const vector<uint> & indexes) :
+		mIndexes(indexes) {
+	}
+
+	void sort(RowType * begin, RowType * end) const {
+		sortFrom(begin, end, 0);
+	}
+
+	void sort(vector<RowType> & rows) const {
+		if (!rows.empty())
+			sort(&rows[0], &rows[0] + rows.size());
+	}
+
+private:
+	// compares the columns from a given level on
+	class LevelCmp {
+	public:
+		LevelCmp(const vector<uint> & indexes, uint level) :
+			mIndexes(indexes), mLevel(level) {
+		}
+		bool operator()(const RowType & a, const RowType & b) const {
+			for (uint l = mLevel; l < mIndexes.size(); ++l) {
+				const uint k = mIndexes[l];
+				if (a[k] < b[k])
+					return true;
+				else if (a[k] > b[k])
+					return false;
+			}
+			return false;
+		}
+		const vector<uint> & mIndexes;
+		uint mLevel;
+	};
+
+	void sortFrom(RowType * begin, RowType * end, uint level) const {
+		while (true) {
+			const uint64 n = end - begin;
+			if ((n < 2) or (level >= mIndexes.size()))
+				return;
+			if (n < SMALLBUCKET) {
+				std::sort(begin, end, LevelCmp(mIndexes, level));
+				return;
+			}
+			const uint column = mIndexes[level];
+			uint minvalue = begin[0][column], maxvalue = begin[0][column];
+			for (const RowType * i = begin + 1; i != end; ++i) {
+				const uint v = (*i)[column];
+				if (v < minvalue)
+					minvalue = v;
+				else if (v > maxvalue)
+					maxvalue = v;
+			}
+			if (minvalue == maxvalue) {
+				++level;// nothing to do for this column
+				continue;
+			}
+			// no more digit values than about one per row
+			uint digitbits = MINDIGITBITS;
+			while ((digitbits < MAXDIGITBITS) and ((static_cast<uint64> (1)
+					<< digitbits) < n))
+				++digitbits;
+			const uint range = maxvalue - minvalue;
+			uint shift = 0;
+			while ((static_cast<uint64> (range) >> shift) >= (static_cast<uint64> (1)
+					<< digitbits))
+				++shift;
+			partition(begin, end, level, minvalue, shift, range >> shift);
+			return;
+		}
+	}
+
+	void partition(RowType * begin, RowType * end, const uint level,
+			const uint minvalue, const uint shift, const uint maxdigit) const {
+		const uint column = mIndexes[level];
+		vector<uint64> bucketend(maxdigit + 1, 0);
+		for (const RowType * i = begin; i != end; ++i)
+			++bucketend[((*i)[column] - minvalue) >> shift];
+		for (uint d = 1; d <= maxdigit; ++d)
+			bucketend[d] += bucketend[d - 1];
+		vector<uint64> next(maxdigit + 1);
+		next[0] = 0;
+		for (uint d = 1; d <= maxdigit; ++d)
+			next[d] = bucketend[d - 1];
+		// cycle each misplaced row to its bucket
+		for (uint d = 0; d <= maxdigit; ++d) {
+			while (next[d] < bucketend[d]) {
+				RowType & slot = begin[next[d]];
+				uint e = (slot[column] - minvalue) >> shift;
+				if (e != d) {
+					RowType carried = slot;
+					do {
+						RowType & target = begin[next[e]++];
+						std::swap(carried, target);
+						e = (carried[column] - minvalue) >> shift;
+					} while (e != d);
+					slot = carried;
+				}
+				++next[d];
+			}
+		}
+		// with shift == 0 a bucket shares the value of this column
+		const uint nextlevel = shift == 0 ? level + 1 : level;
+		uint64 start = 0;
+		for (uint d = 0; d <= maxdigit; ++d) {
+			sortFrom(begin + start, begin + bucketend[d], nextlevel);
+			start = bucketend[d];
+		}
+	}
+
+	const vector<uint> & mIndexes;
+};
+
+// sorts rows lexicographically over the columns in indexes
+template<class RowType>
+void radixSort(vector<RowType> & rows, const vector<uint> & indexes) {
+	RadixSorter<RowType> sorter(indexes);
+	sorter.sort(rows);
+}
+
+#endif /* RADIXSORT_H_ */
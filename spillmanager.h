@@ -0,0 +1,155 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef SPILLMANAGER_H_
+#define SPILLMANAGER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/statvfs.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <stdexcept>
+#include <iostream>
+
+using namespace std;
+
+typedef unsigned long long uint64;
+
+/**
+ * Decides where temporary files go. The directories are taken from
+ * ROWREORDER_SPILLDIRS (colon-separated), or else TMPDIR, or else /tmp.
+ * New files are handed out round-robin, skipping directories that do not
+ * have room for the expected size, so that with several devices their
+ * bandwidth adds up. Callers may ask to avoid a given directory (e.g.,
+ * the one they are reading from).
+ */
+class SpillManager {
+public:
+	static SpillManager & instance() {
+		static SpillManager manager;
+		return manager;
+	}
+
+	void setDirectories(const vector<string> & dirs) {
+		lock_guard<mutex> lock(mMutex);
+		mDirectories = dirs;
+		if (mDirectories.empty())
+			mDirectories.push_back(defaultDirectory());
+		mReserved.assign(mDirectories.size(), 0);
+		mCursor = 0;
+	}
+
+	const vector<string> & directories() const {
+		return mDirectories;
+	}
+
+	// bytes available in a directory, minus what our open files reserved
+	uint64 freeSpace(const uint dir) const {
+		struct statvfs s;
+		if (statvfs(mDirectories[dir].c_str(), &s) != 0)
+			return 0;
+		const uint64 available = static_cast<uint64> (s.f_bavail) * s.f_frsize;
+		return available > mReserved[dir] ? available - mReserved[dir] : 0;
+	}
+
+	/**
+	 * Creates a new empty file and returns its name. The index of the
+	 * directory is written to dir; pass it back to release() once the file
+	 * is deleted.
+	 */
+	string createFile(int & dir, const uint64 expectedbytes = 0,
+			const int avoid = -1) {
+		lock_guard<mutex> lock(mMutex);
+		dir = pickDirectory(expectedbytes, avoid);
+		string filename = mDirectories[dir] + "/rowreorderXXXXXX";
+		vector<char> buffer(filename.begin(), filename.end());
+		buffer.push_back('\0');
+		const int fd = mkstemp(&buffer[0]);
+		if (fd < 0) {
+			cerr << "Can't create a file in " << mDirectories[dir] << endl;
+			cerr << "Check your TMPDIR or ROWREORDER_SPILLDIRS variables"
+					<< endl;
+			cerr << strerror(errno) << endl;
+			throw runtime_error("could not open temp file");
+		}
+		::close(fd);
+		mReserved[dir] += expectedbytes;
+		return string(&buffer[0]);
+	}
+
+	void release(const int dir, const uint64 expectedbytes) {
+		lock_guard<mutex> lock(mMutex);
+		if ((dir < 0) or (static_cast<uint> (dir) >= mReserved.size()))
+			return;
+		mReserved[dir] = mReserved[dir] > expectedbytes ? mReserved[dir]
+				- expectedbytes : 0;
+	}
+
+private:
+	SpillManager() :
+		mDirectories(), mReserved(), mCursor(0), mMutex() {
+		vector<string> dirs;
+		const char * spilldirs = getenv("ROWREORDER_SPILLDIRS");
+		if (spilldirs != NULL) {
+			string all(spilldirs);
+			size_t begin = 0;
+			while (begin <= all.size()) {
+				size_t end = all.find(':', begin);
+				if (end == string::npos)
+					end = all.size();
+				if (end > begin)
+					dirs.push_back(all.substr(begin, end - begin));
+				begin = end + 1;
+			}
+		}
+		setDirectories(dirs);
+		if (mDirectories.size() > 1)
+			cout << "# spilling to " << mDirectories.size()
+					<< " directories" << endl;
+	}
+	SpillManager(const SpillManager &);
+	SpillManager & operator=(const SpillManager &);
+
+	static string defaultDirectory() {
+		if (getenv("TMPDIR") != NULL)
+			return string(getenv("TMPDIR"));
+		return string("/tmp");
+	}
+
+	uint pickDirectory(const uint64 expectedbytes, const int avoid) {
+		const uint n = mDirectories.size();
+		// first pass respects avoid, second pass does not
+		for (int pass = 0; pass < 2; ++pass) {
+			for (uint k = 0; k < n; ++k) {
+				const uint dir = (mCursor + k) % n;
+				if ((pass == 0) and (n > 1) and (static_cast<int> (dir)
+						== avoid))
+					continue;
+				if ((expectedbytes > 0) and (freeSpace(dir) < expectedbytes))
+					continue;
+				mCursor = dir + 1;
+				return dir;
+			}
+		}
+		// nobody has room: take the emptiest and hope for the best
+		uint best = 0;
+		for (uint dir = 1; dir < n; ++dir)
+			if (freeSpace(dir) > freeSpace(best))
+				best = dir;
+		return best;
+	}
+
+	vector<string> mDirectories;
+	vector<uint64> mReserved;
+	uint mCursor;
+	mutex mMutex;
+};
+
+#endif /* SPILLMANAGER_H_ */
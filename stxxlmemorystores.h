@@ -10,8 +10,14 @@
 
 #include <unistd.h>
 #include <unordered_set>
+#include <deque>
+#include <exception>
+#include <memory>
 #include "externalvector.h"
 #include "stxxlrowreordering.h"
+#include "indirectsort.h"
+#include "radixsort.h"
+#include "pagedarray.h"
 
 using namespace std;
 
@@ -21,6 +27,9 @@ typedef unsigned long long uint64;
 namespace parameters {
 const bool verbose = false;
 const bool verboseMem = false;
+// rows with at least this many columns are sorted through compact keys
+const int indirectsortminimumcolumns = 24;
+const int indirectsortkeywords = 4;
 }
 ;
 
@@ -55,29 +64,49 @@ public:
 	vector<uint> mIndexes;
 };
 
+// sorted runs are prefix-truncated in the comparator's column order
+template<int c>
+vector<uint> runColumnOrder(const Cmp<c> & cmp) {
+	return cmp.mIndexes;
+}
+
+// the values are small integer codes: blocks are radix sorted
+template<class DataType, int c>
+void sortBlock(vector<DataType> & buffer, Cmp<c> & cmp) {
+	radixSort(buffer, cmp.mIndexes);
+}
+
 template<int c> // number of columns
 class RowStore {
 public:
 	RowStore(uint NumberOfRows) :
-		data(NumberOfRows) {
+		data(NumberOfRows), mCheckpoint(NULL) {
 	}
 	RowStore() :
-		data() {
+		data(), mCheckpoint(NULL) {
 	}
 	
 	~RowStore() {
 		clear();
 	}
 
-	void top(const uint number, RowStore<c> & o) const {
-		externalvector<lazyboost::array<uint, c> > newdata = data.top(number);
-		o.data.swap(newdata);
+	// keeps the first rows; when o is this store, no data is copied
+	void top(const uint number, RowStore<c> & o) {
+		if (&o == this) {
+			forgetCheckpointedData();
+			data.truncate(number);
+			return;
+		}
+		o.data = data.top(number);
+	}
+
+	externalrange<lazyboost::array<uint, c> > view(const uint64 number) const {
+		return data.range(0, number);
 	}
 
 
-	void fillWithSample(const uint number, RowStore<c> & o) {
-		externalvector<lazyboost::array<uint, c> > newdata = data.buildSample(number);
-		o.data.swap(newdata);
+	void fillWithSample(const uint number, RowStore<c> & o, const uint64 seed = 0) {
+		o.data = data.buildSample(number, seed);
 	}
 
 	void clear() {
@@ -88,12 +117,15 @@ public:
 
 	template<class FF>
 	RowStore(FF & f, const uint maxnumberofrows) :
-	data() {
+	data(), mCheckpoint(NULL) {
 		if(parameters::verbose) cout<<"opening data"<<endl;
 		data.open();
 		if(parameters::verbose) cout<<"opening data:ok"<<endl;
+		// the array constructor leaves its elements uninitialized
 		lazyboost::array<int, c> cont;
+		cont.fill(0);
 		lazyboost::array<uint, c> rowbuffer;
+		rowbuffer.fill(0);
 		if(parameters::verboseMem) printMemoryUsage();
 		if(maxnumberofrows>0) {
 			uint nbrrows = 0;
@@ -126,41 +158,701 @@ public:
 		return data.size() * c * sizeof(uint);
 	}
 
-	void sortRows(vector<uint> & indexes) {
+	// sorts resume from (and record their progress in) this checkpoint,
+	// NULL for none; the caller keeps ownership
+	void setCheckpoint(Checkpoint * checkpoint) {
+		mCheckpoint = checkpoint;
+	}
+
+	// data is about to change in place: if it is a file of the checkpoint
+	// (the input or a finished sort), a crash from now on must not resume
+	// from it, so the completed phases are forgotten
+	void forgetCheckpointedData() {
+		if ((mCheckpoint == NULL) or !data.isPersistent())
+			return;
+		mCheckpoint->eraseCompleted();
+		mCheckpoint->save();
+	}
+
+	// cardinalities are optional, they allow wide rows to be sorted by key
+	void sortRows(vector<uint> & indexes, const vector<uint> & cardinalities = vector<uint>()) {
+		if(c >= parameters::indirectsortminimumcolumns) {
+			sortRowsIndirect(indexes, cardinalities);
+			return;
+		}
+		Cmp<c> cmp(indexes);
+		data.sort(cmp, data.defaultBlockSize(), defaultRunFormat(), mCheckpoint);
+	}
+
+	/**
+	 * Sorts (key, row id) records and then moves each row once. The key packs
+	 * as many columns as fit in parameters::indirectsortkeywords words; if
+	 * cardinalities is empty, it is computed with an extra scan.
+	 */
+	void sortRowsIndirect(vector<uint> & indexes, const vector<uint> & cardinalities = vector<uint>()) {
 		Cmp<c> cmp(indexes);
-		data.sort(cmp);
+		IndirectSorter<c, parameters::indirectsortkeywords, Cmp<c> > sorter(indexes,
+				cardinalities.empty() ? computeCardinalities() : cardinalities, cmp);
+		sorter.sort(data, data.defaultBlockSize(), mCheckpoint);
 	}
 
+	// one more than the largest value of each column
+	vector<uint> computeCardinalities(const uint64 BLOCKSIZE = externalvector<lazyboost::array<uint, c> >::defaultBlockSize()) const {
+		vector<uint> cardinalities(c, 0);
+		vector<lazyboost::array<uint, c> > buffer;
+		for (uint64 k = 0; k < data.size(); k += BLOCKSIZE) {
+			data.loadACopy(buffer, k, k + BLOCKSIZE < data.size() ? k + BLOCKSIZE : data.size());
+			for (uint64 r = 0; r < buffer.size(); ++r)
+				for (uint j = 0; j < c; ++j)
+					if (buffer[r][j] >= cardinalities[j])
+						cardinalities[j] = buffer[r][j] + 1;
+		}
+		return cardinalities;
+	}
+
+	/**
+	 * The rows are turned into Vortex keys (see VortexKey), the keys are
+	 * sorted lexicographically and turned back into rows. If some value is
+	 * too large for a key, we sort the rows with the Vortex comparator.
+	 */
 	void vortexSortRows(vector<uint> & indexes) {
 		if (data.size() == 0)
 			return;//no data
-		Vortex v(indexes);
-		data.sort(v);
+		typedef lazyboost::array<uint, c> row;
+		const VortexKey vortexkey(indexes);
+		externalvector<row> keys;
+		const bool fromcheckpoint = (mCheckpoint != NULL)
+				and keys.attachSorted(*mCheckpoint, "vortex");
+		if (!fromcheckpoint) {
+			if ((indexes.size() != c) or !transformRows(data, keys,
+					[&vortexkey](const row & r, row & k) {
+						return vortexkey.encode(r, k);
+					})) {
+				keys.close();
+				Vortex v(indexes);
+				data.sort(v, data.defaultBlockSize(), defaultRunFormat(), mCheckpoint);
+				return;
+			}
+			vector<uint> keyorder = identityColumnOrder<c> ();
+			Cmp<c> lexicographic(keyorder);
+			keys.sort(lexicographic, keys.defaultBlockSize(), defaultRunFormat(),
+					mCheckpoint, "vortex");
+		}
+		externalvector<row> sorted;
+		transformRows(keys, sorted, [&vortexkey](const row & k, row & r) {
+			vortexkey.decode(k, r);
+			return true;
+		});
+		data = std::move(sorted);
+	}
+
+	// reflected Gray-code order (see GrayCodeKey and sortRowsByKey)
+	void grayCodeSortRows(vector<uint> & indexes,
+			const vector<uint> & cardinalities = vector<uint>()) {
+		sortRowsByKey(indexes, cardinalities, "graycode",
+				[&indexes](const vector<uint> & cards) {
+					return GrayCodeKey(indexes, cards);
+				});
+	}
+
+	// Z-order or Hilbert-curve order (see SpaceFillingKey and sortRowsByKey)
+	void spaceFillingSortRows(vector<uint> & indexes,
+			const SpaceFillingKey::Curve curve,
+			const vector<uint> & cardinalities = vector<uint>()) {
+		sortRowsByKey(indexes, cardinalities, curve == SpaceFillingKey::HILBERT
+				? "hilbert" : "zorder", [&indexes, curve](const vector<uint> & cards) {
+			return SpaceFillingKey(indexes, cards, curve);
+		});
+	}
+
+	/**
+	 * Sorts the rows through keys built from the cardinalities by makekey
+	 * (see GrayCodeKey or SpaceFillingKey): the rows are turned into keys,
+	 * sorted lexicographically and turned back, at about the cost of a
+	 * lexicographic sort. If cardinalities is empty or does not cover the
+	 * values, it is computed with an extra scan.
+	 */
+	template<class F>
+	void sortRowsByKey(vector<uint> & indexes,
+			const vector<uint> & cardinalities, const string & name, F makekey) {
+		if (data.size() == 0)
+			return;//no data
+		if (indexes.size() != c)
+			throw runtime_error("this order needs every column");
+		typedef lazyboost::array<uint, c> row;
+		auto key = makekey(cardinalities.size() == c ? cardinalities
+				: computeCardinalities());
+		externalvector<row> keys;
+		const bool fromcheckpoint = (mCheckpoint != NULL)
+				and keys.attachSorted(*mCheckpoint, name);
+		if (!fromcheckpoint) {
+			Checkpoint * checkpoint = mCheckpoint;
+			if (!transformRows(data, keys, [&key](const row & r, row & k) {
+				return key.encode(r, k);
+			})) {
+				// a resumed job could not tell which cardinalities we used
+				checkpoint = NULL;
+				key = makekey(computeCardinalities());
+				transformRows(data, keys, [&key](const row & r, row & k) {
+					return key.encode(r, k);
+				});
+			}
+			vector<uint> keyorder = identityColumnOrder<c> ();
+			Cmp<c> lexicographic(keyorder);
+			keys.sort(lexicographic, keys.defaultBlockSize(), defaultRunFormat(),
+					checkpoint, name);
+		}
+		externalvector<row> sorted;
+		transformRows(keys, sorted, [&key](const row & k, row & r) {
+			key.decode(k, r);
+			return true;
+		});
+		data = std::move(sorted);
+	}
+
+	/**
+	 * Fills out with f(row) for each row of in, a chunk at a time (the
+	 * chunk is shared among the compute threads). Stops and returns false
+	 * as soon as f does.
+	 */
+	template<class F, class Out>
+	static bool transformRows(const externalvector<lazyboost::array<uint, c> > & in,
+			externalvector<Out> & out, F f,
+			const uint64 BLOCKSIZE = externalvector<lazyboost::array<uint, c> >::defaultBlockSize()) {
+		typedef lazyboost::array<uint, c> row;
+		out.close();
+		out.open(in.size() * sizeof(Out));
+		ThreadPool & pool = computeThreadPool();
+		vector<row> buffer;
+		vector<Out> transformed;
+		for (uint64 begin = 0; begin < in.size(); begin += BLOCKSIZE) {
+			in.loadACopy(buffer, begin, begin + BLOCKSIZE < in.size() ? begin
+					+ BLOCKSIZE : in.size());
+			transformed.resize(buffer.size());
+			const uint64 parts = pool.size();
+			vector<future<bool> > done;
+			for (uint64 part = 0; part < parts; ++part) {
+				const row * from = &buffer[0] + buffer.size() * part / parts;
+				const row * to = &buffer[0] + buffer.size() * (part + 1) / parts;
+				Out * target = &transformed[0] + buffer.size() * part / parts;
+				done.push_back(pool.submit([from, to, target, &f]() {
+							for (const row * i = from; i != to; ++i)
+							if (!f(*i, target[i - from]))
+							return false;
+							return true;
+						}));
+			}
+			bool ok = true;
+			for (uint64 part = 0; part < done.size(); ++part)
+				ok = done[part].get() and ok;
+			if (!ok)
+				return false;
+			out.append(transformed);
+		}
+		return true;
+	}
+
+	enum {
+		LSHHASHES = 2, LSHMAXBUCKET = 128
+	};
+
+	/**
+	 * An order with small Hamming distances between consecutive rows, at
+	 * near-linear cost. Each row gets LSHHASHES MinHash values (see
+	 * MinHashSignature) and the rows are sorted externally by these values,
+	 * then lexicographically: a bucket (rows sharing their signature) is
+	 * contiguous, and buckets sharing their first hash are together. The
+	 * sorted rows are streamed in chunks ending at bucket boundaries;
+	 * compute threads chain the rows of each bucket greedily (see
+	 * greedyChain), in pieces of at most LSHMAXBUCKET rows, the chain going
+	 * on from one bucket into the next. The chunks come back in order and
+	 * are stitched together (see stitchBlock), so the result does not depend
+	 * on the number of threads.
+	 */
+	void lshSortRows(vector<uint> & indexes, const uint64 CHUNKSIZE = 65536) {
+		cout << "# LSH chaining with " << LSHHASHES << " hashes per signature"
+				<< endl;
+		if (data.size() == 0)
+			return;//no data
+		if (indexes.size() != c)
+			throw runtime_error("this order needs every column");
+		typedef lazyboost::array<uint, c> row;
+		typedef lazyboost::array<uint, c + LSHHASHES> tagged;
+		externalvector<tagged> buckets;
+		{
+			PhaseTimer hashing("lsh: signatures");
+			const MinHashSignature signature(LSHHASHES);
+			transformRows(data, buckets, [&signature](const row & r, tagged & t) {
+				copy(r.begin(), r.end(), t.begin());
+				for (uint h = 0; h < LSHHASHES; ++h)
+					t[c + h] = signature.hash(r, h);
+				return true;
+			});
+			vector<uint> order;
+			for (uint h = 0; h < LSHHASHES; ++h)
+				order.push_back(c + h);
+			order.insert(order.end(), indexes.begin(), indexes.end());
+			Cmp<c + LSHHASHES> bysignature(order);
+			buckets.sort(bysignature, buckets.defaultBlockSize(),
+					defaultRunFormat());
+		}
+		PhaseTimer chaining("lsh: chaining");
+		ThreadPool & pool = computeThreadPool();
+		// a chunk in flight holds the tagged rows and the chained rows
+		const uint64 chunkbytes = CHUNKSIZE * (sizeof(tagged) + sizeof(row));
+		MemoryLease lease(pool.size() * chunkbytes, chunkbytes);
+		uint64 concurrency = lease.bytes() / chunkbytes;
+		if (concurrency > pool.size())
+			concurrency = pool.size();
+		if (concurrency < 1)
+			concurrency = 1;
+		deque<future<vector<row> > > pending;
+		exception_ptr failure;
+		externalvector<row> chained;
+		chained.open(data.size() * sizeof(row));
+		IOBatch writes;
+		row last;
+		last.fill(0);// the row type does not zero itself
+		bool haslast = false;
+		vector<tagged> buffer, carry;
+		uint64 next = 0;
+		for (;;) {
+			const bool more = (next < buckets.size()) or !carry.empty();
+			if (pending.empty() and (failure or !more))
+				break;
+			if (!failure and more) {
+				const uint64 end = next + CHUNKSIZE < buckets.size() ? next
+						+ CHUNKSIZE : buckets.size();
+				buckets.loadACopy(buffer, next, end);
+				next = end;
+				shared_ptr<vector<tagged> > chunk(new vector<tagged> ());
+				chunk->swap(carry);
+				chunk->insert(chunk->end(), buffer.begin(), buffer.end());
+				if (next < buckets.size()) {
+					// the last bucket may go on: it waits for the next chunk
+					size_t cut = chunk->size();
+					while ((cut > 0) and sameBucket((*chunk)[cut - 1],
+							chunk->back()))
+						--cut;
+					if (cut > 0) {
+						carry.assign(chunk->begin() + cut, chunk->end());
+						chunk->resize(cut);
+					}
+				}
+				pending.push_back(pool.submit([chunk]() {
+					vector<row> rows(chunk->size());
+					for (size_t k = 0; k < rows.size(); ++k)
+						copy((*chunk)[k].begin(), (*chunk)[k].begin() + c,
+								rows[k].begin());
+					row current;
+					current.fill(0);
+					bool hascurrent = false;
+					for (size_t begin = 0; begin < rows.size();) {
+						size_t end = begin + 1;
+						while ((end < rows.size()) and (end - begin < LSHMAXBUCKET)
+								and sameBucket((*chunk)[begin], (*chunk)[end]))
+							++end;
+						greedyChain(rows.begin() + begin, rows.begin() + end,
+								current, hascurrent);
+						begin = end;
+					}
+					return rows;
+				}));
+				if ((pending.size() < concurrency) and ((next < buckets.size())
+						or !carry.empty()))
+					continue;
+			}
+			vector<row> rows;
+			try {
+				rows = pending.front().get();
+			} catch (...) {
+				if (!failure)
+					failure = current_exception();
+			}
+			pending.pop_front();
+			if (failure or rows.empty())
+				continue;
+			stitchBlock(rows, haslast ? &last : NULL, STITCHSTARTANDORIENTATION);
+			last = rows.back();
+			haslast = true;
+			chained.append(std::move(rows), writes);
+			writes.submit();
+		}
+		writes.wait();
+		if (failure)
+			rethrow_exception(failure);
+		buckets.close();
+		data = std::move(chained);
+	}
+
+	// whether two tagged rows (see lshSortRows) have the same signature
+	template<class Tagged>
+	static bool sameBucket(const Tagged & a, const Tagged & b) {
+		for (uint k = c; k < a.size(); ++k)
+			if (a[k] != b[k])
+				return false;
+		return true;
+	}
+
+	/**
+	 * The multiple-lists order of the whole table, out of core. The c lists
+	 * are kept on disk as prev/next links (see linkMultipleLists) and read,
+	 * like the rows, through page caches (see PagedArray) sharing a lease
+	 * from the memory budget. Each step of the greedy tour fetches the rows
+	 * and links of all the neighbours of the current row in one batch; the
+	 * unlinking updates go back to disk as their pages are evicted.
+	 * Starting from the first row, we get the order that
+	 * MultipleListsSortRowsPerBlock gives with a single block.
+	 */
+	void MultipleListsSortRows(vector<uint> & indexes) {
+		typedef lazyboost::array<uint, c> row;
+		typedef lazyboost::array<uint, 2 * c> linkrow;
+		const uint64 n = data.size();
+		cout << "# multiplelists sorting all " << n << " rows" << endl;
+		if (n < 2)
+			return;// nothing to do
+		if ((n >= UINT_MAX) or (indexes.size() != c)) {
+			cerr << "cannot link " << n << " rows over " << indexes.size()
+					<< " columns" << endl;
+			throw runtime_error("unsupported multiple lists");
+		}
+		data.flush();
+		externalvector<linkrow> links;
+		{
+			PhaseTimer linking("multiplelists: links");
+			linkMultipleLists(indexes, links);
+		}
+		PhaseTimer touring("multiplelists: tour");
+		// a step names the current row and up to 2c neighbours
+		const uint64 pagesperstep = 2 * c + 1;
+		const uint64 minimumrowbytes = pagesperstep * (PagedArray<row>::PAGEBYTES
+				+ sizeof(row));
+		const uint64 minimumlinkbytes = pagesperstep
+				* (PagedArray<linkrow>::PAGEBYTES + sizeof(linkrow));
+		MemoryLease lease(n * (sizeof(row) + sizeof(linkrow)) + minimumrowbytes
+				+ minimumlinkbytes, minimumrowbytes + minimumlinkbytes);
+		uint64 rowbytes = lease.bytes() / (sizeof(row) + sizeof(linkrow))
+				* sizeof(row);
+		if (rowbytes < minimumrowbytes)
+			rowbytes = minimumrowbytes;
+		const uint64 linkbytes = lease.bytes() > rowbytes + minimumlinkbytes ? lease.bytes()
+				- rowbytes : minimumlinkbytes;
+		PagedArray<row> rows(data, rowbytes);
+		PagedArray<linkrow> linked(links, linkbytes);
+		externalvector<row> tour;
+		tour.open(n * sizeof(row));
+		IOBatch fetches, writes;
+		vector<uint64> wanted(1, 0);
+		rows.fetch(wanted, fetches);
+		linked.fetch(wanted, fetches);
+		fetches.submit();
+		fetches.wait();
+		for (uint pos = 0; pos != UINT_MAX;) {
+			const row current = rows.get(pos);
+			const linkrow around = linked.get(pos);
+			tour.append(current, writes);
+			wanted.assign(1, pos);
+			for (uint k = 0; k < 2 * c; ++k)
+				if (around[k] != UINT_MAX)
+					wanted.push_back(around[k]);
+			rows.fetch(wanted, fetches);
+			linked.fetch(wanted, fetches);
+			fetches.submit();
+			fetches.wait();
+			uint best = UINT_MAX, besthamming = UINT_MAX;
+			for (uint k = 0; k < c; ++k) {
+				const uint before = around[2 * k];
+				const uint after = around[2 * k + 1];
+				if (before != UINT_MAX) {
+					const uint h = rowHamming(current, rows.get(before));
+					if (h < besthamming) {
+						besthamming = h;
+						best = before;
+					}
+					linked.modify(before)[2 * k + 1] = after;
+				}
+				if (after != UINT_MAX) {
+					const uint h = rowHamming(current, rows.get(after));
+					if (h < besthamming) {
+						besthamming = h;
+						best = after;
+					}
+					linked.modify(after)[2 * k] = before;
+				}
+			}
+			pos = best;
+		}
+		tour.flush(writes);
+		writes.wait();
+		cout << "# multiplelists: " << rows.misses() << " row pages and "
+				<< linked.misses() << " link pages read during the tour" << endl;
+		data = std::move(tour);
+	}
+
+	/**
+	 * links[id][2k] and links[id][2k + 1] are the rows before and after row
+	 * id in list k, that is, when the rows are sorted lexicographically
+	 * starting from column indexes[k] (UINT_MAX at the ends). For each list,
+	 * the rows, tagged with their ids, are sorted externally; the (id,
+	 * before, after) triples are put back in id order with a second sort,
+	 * and the c lists are zipped together.
+	 */
+	void linkMultipleLists(const vector<uint> & indexes,
+			externalvector<lazyboost::array<uint, 2 * c> > & links,
+			const uint64 BLOCKSIZE = externalvector<lazyboost::array<uint, c> >::defaultBlockSize()) {
+		typedef lazyboost::array<uint, c> row;
+		typedef lazyboost::array<uint, c + 1> tagged;
+		typedef lazyboost::array<uint, 3> triple;
+		typedef lazyboost::array<uint, 2 * c> linkrow;
+		const uint64 n = data.size();
+		externalvector<tagged> rows;
+		rows.open(n * sizeof(tagged));
+		vector<row> buffer;
+		tagged t;
+		for (uint64 begin = 0; begin < n; begin += BLOCKSIZE) {
+			data.loadACopy(buffer, begin, begin + BLOCKSIZE < n ? begin
+					+ BLOCKSIZE : n);
+			for (uint64 r = 0; r < buffer.size(); ++r) {
+				copy(buffer[r].begin(), buffer[r].end(), t.begin());
+				t[c] = static_cast<uint> (begin + r);
+				rows.append(t);
+			}
+		}
+		buffer.clear();
+		vector<externalvector<triple> > lists(c);
+		vector<uint> order(c), byid(1, 0);
+		Cmp<3> idorder(byid);
+		vector<tagged> sorted;
+		for (uint k = 0; k < c; ++k) {
+			for (uint j = 0; j < c; ++j)
+				order[j] = indexes[(k + j) % c];
+			Cmp<c + 1> listorder(order);
+			rows.sort(listorder, rows.defaultBlockSize(), defaultRunFormat());
+			lists[k].open(n * sizeof(triple));
+			// the triple of a row is complete once we see the next one
+			triple pending;
+			pending[0] = UINT_MAX;
+			for (uint64 begin = 0; begin < n; begin += BLOCKSIZE) {
+				rows.loadACopy(sorted, begin, begin + BLOCKSIZE < n ? begin
+						+ BLOCKSIZE : n);
+				for (uint64 r = 0; r < sorted.size(); ++r) {
+					const uint id = sorted[r][c];
+					const uint before = pending[0];
+					if (before != UINT_MAX) {
+						pending[2] = id;
+						lists[k].append(pending);
+					}
+					pending[0] = id;
+					pending[1] = before;
+				}
+			}
+			pending[2] = UINT_MAX;
+			lists[k].append(pending);
+			lists[k].sort(idorder, lists[k].defaultBlockSize(),
+					defaultRunFormat());
+		}
+		rows.close();
+		sorted.clear();
+		links.close();
+		links.open(n * sizeof(linkrow));
+		vector<triple> triples;
+		vector<linkrow> linkbuffer;
+		for (uint64 begin = 0; begin < n; begin += BLOCKSIZE) {
+			const uint64 end = begin + BLOCKSIZE < n ? begin + BLOCKSIZE : n;
+			linkbuffer.resize(end - begin);
+			for (uint k = 0; k < c; ++k) {
+				lists[k].loadACopy(triples, begin, end);
+				for (uint64 r = 0; r < triples.size(); ++r) {
+					linkbuffer[r][2 * k] = triples[r][1];
+					linkbuffer[r][2 * k + 1] = triples[r][2];
+				}
+			}
+			links.append(linkbuffer);
+		}
+		links.flush();
 	}
 
+	/**
+	 * Puts each block of BLOCKSIZE rows in multiple-lists order. Blocks are
+	 * independent: compute threads load and sort them while earlier blocks
+	 * are written back, keeping as many blocks in flight as there are
+	 * threads, or as fit in the memory budget. As they come back, in order,
+	 * each block is written in place, after being stitched to the last row
+	 * of the one before unless stitching is NOSTITCHING (see stitchBlock).
+	 * The result does not depend on the number of threads.
+	 */
 	void MultipleListsSortRowsPerBlock(vector<uint> & indexes,
-			int BLOCKSIZE = 16384) {
+			int BLOCKSIZE = 16384, const Stitching stitching = NOSTITCHING) {
 		cout << "# multiplelists sorting with blocks of size " << BLOCKSIZE
 				<< endl;
 		if (data.size() == 0)
 			return;//no data
-		vector<lazyboost::array<uint,c> > buffer;
-		for (uint64 k = 0; k < data.size(); k += BLOCKSIZE) {
-			if (k + BLOCKSIZE < data.size()) {
-				data.loadACopy(buffer,k,k+BLOCKSIZE);
-				MultipleListsSort<vector<lazyboost::array<uint,c> > > (
-						buffer.begin(), buffer.end(), indexes);
-				data.copyAt(buffer,k);
-			} else {
-				data.loadACopy(buffer,k,data.size());
-				MultipleListsSort<vector<lazyboost::array<uint,c> > > (
-						buffer.begin(), buffer.end(), indexes);
-				data.copyAt(buffer,k);
+		typedef lazyboost::array<uint, c> row;
+		// blocks are rewritten in place: nothing may be left in the tail
+		data.flush();
+		forgetCheckpointedData();
+		PhaseTimer sorting("multiplelists: blocks");
+		ThreadPool & pool = computeThreadPool();
+		const uint64 howmanyblocks = data.size() / BLOCKSIZE + (data.size()
+				% BLOCKSIZE == 0 ? 0 : 1);
+		// a block in flight holds its rows and the buffers of its sorter;
+		// one more block of rows is being written
+		const uint64 rowbytes = static_cast<uint64> (BLOCKSIZE) * sizeof(row);
+		const uint64 blockbytes = rowbytes + static_cast<uint64> (BLOCKSIZE)
+				* MultipleListsSorter::bytesPerRow(c);
+		MemoryLease lease(pool.size() * blockbytes + rowbytes, blockbytes
+				+ rowbytes);
+		uint64 concurrency = lease.bytes() < rowbytes ? 0 : (lease.bytes()
+				- rowbytes) / blockbytes;
+		if (concurrency > pool.size())
+			concurrency = pool.size();
+		if (concurrency < 1)
+			concurrency = 1;
+		// the sorters keep their buffers from one block to the next, under
+		// the lease; block b uses sorter b % concurrency, which the block
+		// before it has given back
+		vector<MultipleListsSorter> sorters(concurrency);
+		const externalvector<row> * store = &data;
+		const vector<uint> * order = &indexes;
+		deque<future<vector<row> > > pending;
+		exception_ptr failure;
+		IOBatch writes;
+		row last;
+		last.fill(0);// the row type does not zero itself
+		uint64 written = 0;
+		// no block may still be using the file when we leave
+		for (uint64 b = 0; !pending.empty() or (!failure and (b
+				< howmanyblocks)); ++b) {
+			if (!failure and (b < howmanyblocks)) {
+				const uint64 begin = b * BLOCKSIZE;
+				const uint64 end = begin + BLOCKSIZE < data.size() ? begin
+						+ BLOCKSIZE : data.size();
+				MultipleListsSorter * sorter = &sorters[b % concurrency];
+				pending.push_back(pool.submit([store, order, sorter, begin, end]() {
+					vector<row> buffer;
+					store->loadACopy(buffer, begin, end);
+					sorter->sort(buffer.begin(), buffer.end(), *order);
+					return buffer;
+				}));
+				if ((pending.size() < concurrency) and (b + 1 < howmanyblocks))
+					continue;
+			}
+			vector<row> buffer;
+			try {
+				buffer = pending.front().get();
+			} catch (...) {
+				if (!failure)
+					failure = current_exception();
+			}
+			pending.pop_front();
+			if (failure)
+				continue;
+			stitchBlock(buffer, written == 0 ? NULL : &last, stitching);
+			last = buffer.back();
+			const uint64 begin = written;
+			written += buffer.size();
+			data.copyAt(std::move(buffer), begin, writes);
+			writes.submit();
+		}
+		writes.wait();
+		if (failure)
+			rethrow_exception(failure);
+	}
+
+	/**
+	 * A column order under which the lexicographically sorted table has few
+	 * runs, estimated on a sample of SAMPLESIZE rows. We start from the
+	 * better of indexes and its reverse, then swap adjacent columns as long
+	 * as some swap lowers the run count of the sorted sample. The
+	 * candidates of a round are sorted and counted by the compute threads,
+	 * one copy of the sample each.
+	 */
+	vector<uint> searchColumnOrder(const vector<uint> & indexes,
+			const uint SAMPLESIZE = 65536, const uint64 seed = 0) const {
+		typedef lazyboost::array<uint, c> row;
+		if ((data.size() == 0) or (indexes.size() < 2))
+			return indexes;
+		PhaseTimer searching("column order search");
+		vector<row> sample;
+		if (data.size() <= SAMPLESIZE)
+			data.loadACopy(sample, 0, data.size());
+		else
+			data.buildSample(SAMPLESIZE, seed).loadACopy(sample, 0, SAMPLESIZE);
+		ThreadPool & pool = computeThreadPool();
+		const uint64 samplebytes = sample.size() * sizeof(row);
+		MemoryLease lease(pool.size() * samplebytes, samplebytes);
+		uint64 concurrency = lease.bytes() / samplebytes;
+		if (concurrency > pool.size())
+			concurrency = pool.size();
+		if (concurrency < 1)
+			concurrency = 1;
+		vector<uint> best(indexes);
+		uint64 bestruns = ~0ULL;
+		vector<vector<uint> > candidates(1, indexes);
+		candidates.push_back(vector<uint> (indexes.rbegin(), indexes.rend()));
+		for (uint round = 0; round <= c * c; ++round) {
+			vector<uint64> runs(candidates.size());
+			deque<pair<size_t, future<uint64> > > pending;
+			exception_ptr failure;
+			for (size_t k = 0; (k < candidates.size()) or !pending.empty();) {
+				if (!failure and (k < candidates.size()) and (pending.size()
+						< concurrency)) {
+					const vector<uint> * order = &candidates[k];
+					pending.push_back(make_pair(k, pool.submit([&sample, order]() {
+						return sortedRunCount(sample, *order);
+					})));
+					++k;
+					continue;
+				}
+				if (pending.empty())
+					break;
+				try {
+					runs[pending.front().first] = pending.front().second.get();
+				} catch (...) {
+					if (!failure)
+						failure = current_exception();
+				}
+				pending.pop_front();
+			}
+			if (failure)
+				rethrow_exception(failure);
+			bool improved = false;
+			for (size_t k = 0; k < candidates.size(); ++k)
+				if (runs[k] < bestruns) {
+					bestruns = runs[k];
+					best = candidates[k];
+					improved = true;
+				}
+			if (!improved)
+				break;
+			candidates.clear();
+			for (size_t k = 0; k + 1 < best.size(); ++k) {
+				candidates.push_back(best);
+				swap(candidates.back()[k], candidates.back()[k + 1]);
 			}
 		}
+		cout << "# column order search: " << bestruns << " runs in a sample of "
+				<< sample.size() << " rows, order";
+		for (size_t k = 0; k < best.size(); ++k)
+			cout << " " << best[k];
+		cout << endl;
+		return best;
 	}
-	void shuffleRows(const uint BLOCKSIZE = externalvector<uint>::DEFAULTBLOCKSIZE) {//1048576
-		data.shuffle(BLOCKSIZE);
+
+	// the number of runs, summed over the columns, once rows are sorted
+	static uint64 sortedRunCount(vector<lazyboost::array<uint, c> > rows,
+			vector<uint> order) {
+		Cmp<c> cmp(order);
+		sort(rows.begin(), rows.end(), cmp);
+		uint64 runs = rows.empty() ? 0 : c;
+		for (size_t k = 1; k < rows.size(); ++k)
+			runs += rowHamming(rows[k - 1], rows[k]);
+		return runs;
+	}
+
+	void shuffleRows(const uint64 BLOCKSIZE = externalvector<lazyboost::array<uint, c> >::defaultBlockSize(), const uint64 seed = 0) {//1048576
+		forgetCheckpointedData();
+		data.shuffle(BLOCKSIZE, seed);
 	}
 
 	void printFirstRows(const uint n) {
@@ -171,7 +863,7 @@ public:
 		}
 	}
 
-	uint64 countZeroes(const uint BLOCKSIZE = externalvector<uint>::DEFAULTBLOCKSIZE) {
+	uint64 countZeroes(const uint64 BLOCKSIZE = externalvector<lazyboost::array<uint, c> >::defaultBlockSize()) {
 		vector<lazyboost::array<uint, c> > buffer;
 		uint64 sum = 0;
 		for (uint64 k = 0; k < data.size(); k += BLOCKSIZE) {
@@ -191,6 +883,82 @@ public:
 	}
 
 	externalvector<lazyboost::array<uint, c> > data;
+	Checkpoint * mCheckpoint;
+};
+
+template<class Column>
+uint64 columnsRunCount(const vector<Column> & columns, const uint64 MAPSIZE) {
+	uint64 answer = 0;
+	vector<uint> buffer;
+	for (typename vector<Column>::const_iterator i = columns.begin(); i
+			!= columns.end(); ++i) {
+		// a run going on from one chunk into the next is counted once
+		for (uint64 rowindex = 0; rowindex < i->size(); rowindex+=MAPSIZE) {
+			const uint last = buffer.empty() ? 0 : buffer.back();
+			i->loadACopy(buffer,rowindex,
+					rowindex + MAPSIZE > i->size() ? i->size()
+							: rowindex + MAPSIZE);
+			answer += runCount(buffer);
+			if ((rowindex > 0) and (buffer[0] == last))
+				--answer;
+		}
+		buffer.clear();
+	}
+	return answer;
+}
+
+template<class Column>
+uint64 columnsRunCountp(const vector<Column> & columns, const uint BLOCKSIZE, const uint64 MAPSIZE) {
+	const uint64 chunk = MAPSIZE < BLOCKSIZE ? BLOCKSIZE : MAPSIZE / BLOCKSIZE
+			* BLOCKSIZE;
+	uint64 answer = 0;
+	vector<uint> buffer;
+	for (typename vector<Column>::const_iterator i = columns.begin(); i
+			!= columns.end(); ++i) {
+		// chunks hold whole blocks, and each chunk after the first starts
+		// with the last block of the one before, which is already counted
+		for (uint64 rowindex = 0; rowindex < i->size(); rowindex+=chunk) {
+			const uint64 begin = rowindex == 0 ? 0 : rowindex - BLOCKSIZE;
+			i->loadACopy(buffer,begin,
+					rowindex + chunk > i->size() ? i->size()
+							: rowindex + chunk);
+			answer += runCountp(buffer,BLOCKSIZE);
+			if (rowindex > 0)
+				--answer;
+		}
+	}
+	return answer;
+}
+
+// Read-only views over the columns of a NaiveColumnStore (see
+// NaiveColumnStore::top). Can be passed to the codec benchmarks.
+class ColumnStoreView {
+public:
+	ColumnStoreView() :
+		data() {
+	}
+
+	uint64 computeRunCount(const uint64 MAPSIZE = externalvector<uint>::defaultBlockSize()) const {
+		return columnsRunCount(data, MAPSIZE);
+	}
+
+	uint64 computeRunCountp(const uint BLOCKSIZE, const uint64 MAPSIZE = externalvector<uint>::defaultBlockSize()) const {
+		return columnsRunCountp(data, BLOCKSIZE, MAPSIZE);
+	}
+
+	uint64 size() const {
+		if (data.size() == 0)
+			return 0;
+		return data.size() * data[0].size() * sizeof(uint);
+	}
+
+	uint64 numberOfRows() const {
+		if (data.size() == 0)
+			return 0;
+		return data[0].size() ;
+	}
+
+	vector<externalrange<uint> > data;
 };
 
 template<int c> // number of columns
@@ -199,9 +967,10 @@ public:
 	NaiveColumnStore() :
 		data() {
 	}
-	void makeColumnsIndependent(const uint BLOCKSIZE = externalvector<uint>::DEFAULTBLOCKSIZE) {//1048576
+	// each column gets its own permutation
+	void makeColumnsIndependent(const uint64 BLOCKSIZE = externalvector<uint>::defaultBlockSize(), const uint64 seed = 0) {//1048576
 		for	(vector<externalvector<uint> >::iterator i =  data.begin(); i!= data.end(); ++i)
-			i->shuffle(BLOCKSIZE);
+			i->shuffle(BLOCKSIZE, seed + (i - data.begin()) + 1);
 	}
 
 
@@ -231,44 +1000,22 @@ public:
 		data.clear();
 	}
 
-	uint64 computeRunCount(const uint MAPSIZE = externalvector<uint>::DEFAULTBLOCKSIZE) {
-		uint64 answer = 0;
-		for (vector<externalvector<uint> >::iterator i = data.begin(); i
-				!= data.end(); ++i) {
-			vector<uint> buffer;
-			for (uint64 rowindex = 0; rowindex < i->size(); rowindex+=MAPSIZE) {
-						i->loadACopy(buffer,rowindex,
-								rowindex + MAPSIZE > i->size() ? i->size()
-										: rowindex + MAPSIZE);
-				      answer += runCount(buffer);
-			}
-		}
-		return answer;
+	uint64 computeRunCount(const uint64 MAPSIZE = externalvector<uint>::defaultBlockSize()) {
+		return columnsRunCount(data, MAPSIZE);
 	}
 
-	uint64 computeRunCountp(const uint BLOCKSIZE, const uint MAPSIZE = externalvector<uint>::DEFAULTBLOCKSIZE) {
-		uint64 answer = 0;
-				for (vector<externalvector<uint> >::iterator i = data.begin(); i
-						!= data.end(); ++i) {
-					vector<uint> buffer;
-					for (uint64 rowindex = 0; rowindex < i->size(); rowindex+=MAPSIZE) {
-						i->loadACopy(buffer,rowindex,
-								rowindex + MAPSIZE > i->size() ? i->size()
-										: rowindex + MAPSIZE);
-						      answer += runCountp(buffer,BLOCKSIZE);
-					}
-				}
-				return answer;
+	uint64 computeRunCountp(const uint BLOCKSIZE, const uint64 MAPSIZE = externalvector<uint>::defaultBlockSize()) {
+		return columnsRunCountp(data, BLOCKSIZE, MAPSIZE);
 	}
 
 	NaiveColumnStore(const RowStore<c> & rs) :
 		data() {
 		reloadFromRowStore(rs);
 	}
-	void copyToRowStore(RowStore<c> & rs,const uint MAPSIZE = externalvector<uint>::DEFAULTBLOCKSIZE) {
+	void copyToRowStore(RowStore<c> & rs,const uint64 MAPSIZE = externalvector<lazyboost::array<uint, c> >::defaultBlockSize()) {
 		rs.data.close();
 		rs.data.open();
-		vector<vector<uint> > buffer(MAPSIZE);
+		vector<vector<uint> > buffer(c);
 		lazyboost::array<uint, c> rowbuffer;
 		uint64 nr = numberOfRows();
 		for(uint64 begin = 0; begin<nr; begin+=MAPSIZE) {
@@ -289,47 +1036,56 @@ public:
 	}
 
 	void reloadFromRowStore(RowStore<c> & rs, const uint maxsize = 0) {
-		if (rs.data.size() == 0)
+		if ((maxsize == 0) or (maxsize >= rs.data.size()))
+			reloadFromRowStore(externalrange<lazyboost::array<uint, c> >(rs.data));
+		else
+			reloadFromRowStore(rs.view(maxsize));
+	}
+
+	void reloadFromRowStore(const externalrange<lazyboost::array<uint, c> > & rows) {
+		if (rows.size() == 0)
 			return;
-		uint64 begin = 0;
+		PhaseTimer transposing("transpose to columns");
 		data.resize(c);
 		for (int k = 0; k < c; ++k) {
 			data[k].close();// just in case
 			data[k].open();//
 		}
-		const uint64 MAPSIZE = getpagesize() * 2048; // appears to default at 1024// 16777216;
+		// the transposition buffers are leased from the memory budget: the
+		// rows, the columns being filled and the columns being written
+		MemoryLease lease(3 * rows.size() * sizeof(lazyboost::array<uint, c>),
+				3 * getpagesize());
+		const uint64 MAPSIZE = lease.elements<lazyboost::array<uint, c> >() / 3;
 
 		vector<lazyboost::array<uint, c> > buffer;
-		if ((maxsize == 0) or (maxsize >= rs.data.size())) {
-
-			for (uint64 rowindex = 0; rowindex < rs.data.size(); rowindex
-					+= MAPSIZE) {
-				rs.data.loadACopy(
-						buffer,
-						begin,
-						begin + MAPSIZE > rs.data.size() ? rs.data.size()
-								: begin + MAPSIZE);
-				for (uint k = 0; k < buffer.size(); ++k) {
-					const lazyboost::array<uint, c> & thisarray = buffer[k];
-					for (uint k = 0; k < data.size(); ++k) {
-						externalvector<uint> & thiscolumn = data[k];
-						thiscolumn.append(thisarray[k]);
-					}
-				}
-			}
-		} else {
-			for (uint64 rowindex = 0; rowindex < maxsize; rowindex += MAPSIZE) {
-				rs.data.loadACopy(buffer, begin,
-						begin + MAPSIZE > maxsize ? maxsize : begin + MAPSIZE);
-				for (uint k = 0; k < buffer.size(); ++k) {
-					const lazyboost::array<uint, c> & thisarray = buffer[k];
-					for (uint k = 0; k < data.size(); ++k) {
-						externalvector<uint> & thiscolumn = data[k];
-						thiscolumn.append(thisarray[k]);
-					}
-				}
+		vector<uint> column;
+		// the columns of a chunk are written together, while we read the
+		// next chunk
+		IOBatch columnwrites;
+		for (uint64 rowindex = 0; rowindex < rows.size(); rowindex
+				+= MAPSIZE) {
+			rows.loadACopy(
+					buffer,
+					rowindex,
+					rowindex + MAPSIZE > rows.size() ? rows.size()
+							: rowindex + MAPSIZE);
+			for (uint k = 0; k < data.size(); ++k) {
+				column.resize(buffer.size());
+				for (uint64 i = 0; i < buffer.size(); ++i)
+					column[i] = buffer[i][k];
+				data[k].append(std::move(column), columnwrites);
 			}
+			columnwrites.submit();
 		}
+		columnwrites.wait();
+	}
+
+	// a view of the first rows of each column, no copy is made
+	ColumnStoreView top(const uint64 number) const {
+		ColumnStoreView answer;
+		for (uint k = 0; k < data.size(); ++k)
+			answer.data.push_back(data[k].range(0, number));
+		return answer;
 	}
 
 	uint64 size() const {
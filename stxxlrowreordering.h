@@ -9,158 +9,339 @@
 #include <algorithm>
 #include <vector>
 #include <cassert>
+#include <climits>
+
+#include "array.h"
+#include "radixsort.h"
+#include "fastrandom.h"
+#include "hamming.h"
 using namespace std;
 
-enum {
-	SORTBUFFER = 50 * 1024 * 1024
-};
+/**
+ * The multiple-lists order of a block of rows: the rows are linked in c
+ * lists, list k being the lexicographic order starting at column
+ * indexes[k] (and wrapping around); starting from the first row, we
+ * repeatedly go to the closest row (in Hamming distance) among the
+ * neighbours of the current row in the lists, unlinking it as we go.
+ *
+ * The rows are copied once into a flat buffer; the (radix) sorts permute
+ * references to rows and the links live in separate prev/next arrays (c
+ * entries per row). When all codes fit in one or two bytes, the distances
+ * are computed on a second, padded copy of the rows with these narrow
+ * codes (see hamming.h), if it is smaller than the rows. The buffers are
+ * kept from one block to the next.
+ */
+class MultipleListsSorter {
+public:
+	MultipleListsSorter() :
+		mRows(), mBytes(), mShorts(), mPrev(), mNext(), mPermutation(),
+				mOrder(), n(0), c(0), mStride(0), mWidth(sizeof(uint)) {
+	}
 
-namespace MultipleListsSortNS {
+	// an upper bound on the bytes the buffers take per row of c columns:
+	// the flat copy, the links, the reference and the narrow copy (smaller
+	// than the flat copy)
+	static size_t bytesPerRow(const size_t c) {
+		return 4 * c * sizeof(uint) + sizeof(RowRef);
+	}
 
-// convenience class used by MultipleLists
-class LexicoOffset {
-public:
-	LexicoOffset(uint k, uint NumberOfColumns, vector<uint> & indexes) :
-		K(k), mNumberOfColumns(NumberOfColumns), mIndexes(indexes) {
+	template<class Iterator>
+	void sort(const Iterator databegin, const Iterator dataend,
+			const vector<uint> & indexes) {
+		n = dataend - databegin;
+		if (n < 2)
+			return;// nothing to do
+		c = databegin->size();
+		if (c == 0)
+			return;
+		mRows.resize(static_cast<size_t> (n) * c);
+		for (uint id = 0; id < n; ++id)
+			copy(databegin[id].begin(), databegin[id].end(), &mRows[0]
+					+ static_cast<size_t> (id) * c);
+		narrow();
+		link(indexes);
+		Iterator writeiter = databegin;
+		for (uint location = 0; location != INVALID; location
+				= unlinkAndFindBestNext(location)) {
+			const uint * row = &mRows[0] + static_cast<size_t> (location) * c;
+			copy(row, row + c, writeiter->begin());
+			++writeiter;
+		}
 	}
-	bool operator()(const vector<uint> & i, const vector<uint> & j) {
-		for (uint k = K; k < mNumberOfColumns; ++k) {
-			const uint thisk = mIndexes[k];
-			if (i[thisk] < j[thisk])
-				return true;
-			if (i[thisk] > j[thisk])
-				return false;
+
+private:
+	enum {
+		INVALID = UINT_MAX
+	};
+
+	// a row of the flat buffer, as seen by the radix sort
+	class RowRef {
+	public:
+		uint operator[](const uint k) const {
+			return row[k];
 		}
-		for (uint k = 0; k < K; ++k) {
-			const uint thisk = mIndexes[k];
-			if (i[thisk] < j[thisk])
-				return true;
-			if (i[thisk] > j[thisk])
-				return false;
+		const uint * row;
+		uint id;
+	};
+
+	// list k links each row to its neighbours in the order starting at
+	// indexes[k]; only whole rows can tie, and the order among equal rows
+	// does not change the result, so any sort will do
+	void link(const vector<uint> & indexes) {
+		const size_t links = static_cast<size_t> (n) * c;
+		mPrev.assign(links, INVALID);
+		mNext.assign(links, INVALID);
+		mPermutation.resize(n);
+		for (uint id = 0; id < n; ++id) {
+			mPermutation[id].row = &mRows[0] + static_cast<size_t> (id) * c;
+			mPermutation[id].id = id;
+		}
+		mOrder.resize(c);
+		for (uint k = 0; k < c; ++k) {
+			for (uint j = 0; j < c; ++j)
+				mOrder[j] = indexes[(k + j) % c];
+			radixSort(mPermutation, mOrder);
+			for (uint x = 0; x < n; ++x) {
+				const size_t at = static_cast<size_t> (mPermutation[x].id) * c + k;
+				if (x > 0)
+					mPrev[at] = mPermutation[x - 1].id;
+				if (x + 1 < n)
+					mNext[at] = mPermutation[x + 1].id;
+			}
 		}
-		return false;
 	}
-	const uint K;
-	const uint mNumberOfColumns;
-	vector<uint> mIndexes;
 
-};
-class SortOnOneKey {
-public:
-	SortOnOneKey(uint k) :
-		K(k) {
+	// picks the narrowest codes holding every value and fills their copy,
+	// unless the padded copy would not be smaller than the rows
+	void narrow() {
+		const uint largest = *max_element(mRows.begin(), mRows.end());
+		mWidth = sizeof(uint);
+		if ((largest <= UINT8_MAX) and fillNarrow(mBytes))
+			mWidth = 1;
+		else
+			vector<uint8_t> ().swap(mBytes);
+		if ((mWidth != 1) and (largest <= UINT16_MAX) and fillNarrow(mShorts))
+			mWidth = 2;
+		else
+			vector<uint16_t> ().swap(mShorts);
+	}
+
+	template<class Code>
+	bool fillNarrow(vector<Code> & narrowrows) {
+		mStride = narrowStride<Code> (c);
+		if (mStride * sizeof(Code) >= c * sizeof(uint))
+			return false;
+		narrowrows.assign(static_cast<size_t> (n) * mStride, 0);
+		for (size_t id = 0; id < n; ++id)
+			copy(&mRows[0] + id * c, &mRows[0] + (id + 1) * c, &narrowrows[0]
+					+ id * mStride);
+		return true;
+	}
+
+	uint hamming(const uint a, const uint b) const {
+		if (mWidth == 1)
+			return hammingDistance(&mBytes[0] + static_cast<size_t> (a)
+					* mStride, &mBytes[0] + static_cast<size_t> (b) * mStride,
+					mStride);
+		if (mWidth == 2)
+			return hammingDistance(&mShorts[0] + static_cast<size_t> (a)
+					* mStride, &mShorts[0] + static_cast<size_t> (b) * mStride,
+					mStride);
+		return hammingDistance(&mRows[0] + static_cast<size_t> (a) * c,
+				&mRows[0] + static_cast<size_t> (b) * c, c);
 	}
-	bool operator()(const vector<uint> & i, const vector<uint> & j) {
-		return i[K] < j[K];
+
+	uint unlinkAndFindBestNext(const uint pos) {
+		uint bestHamming = INVALID;
+		uint bestPos = INVALID;
+		const size_t base = static_cast<size_t> (pos) * c;
+		for (uint k = 0; k < c; ++k) {
+			const uint before = mPrev[base + k];
+			const uint after = mNext[base + k];
+			if (before < n) {
+				const uint h = hamming(pos, before);
+				if (h < bestHamming) {
+					bestHamming = h;
+					bestPos = before;
+				}
+				mNext[static_cast<size_t> (before) * c + k] = after;
+			}
+			if (after < n) {
+				const uint h = hamming(pos, after);
+				if (h < bestHamming) {
+					bestHamming = h;
+					bestPos = after;
+				}
+				mPrev[static_cast<size_t> (after) * c + k] = before;
+			}
+		}
+		return bestPos;
 	}
-	const uint K;
+
+	vector<uint> mRows;// row id * c + column
+	vector<uint8_t> mBytes;// row id * mStride + column, when mWidth is 1
+	vector<uint16_t> mShorts;// row id * mStride + column, when mWidth is 2
+	vector<uint> mPrev, mNext;// row id * c + list
+	vector<RowRef> mPermutation;
+	vector<uint> mOrder;
+	uint n, c;
+	size_t mStride;
+	uint mWidth;// bytes per code in the copy used for distances
+};
+
+// the buffers are freed on return; reuse a MultipleListsSorter to keep them
+template<class C>
+void MultipleListsSort(const typename C::iterator databegin,
+		const typename C::iterator dataend, vector<uint> & indexes) {
+	MultipleListsSorter sorter;
+	sorter.sort(databegin, dataend, indexes);
+}
+
+// how a block sorted on its own is joined to the block before it
+enum Stitching {
+	NOSTITCHING, STITCHSTART, STITCHSTARTANDORIENTATION
 };
 
-uint Hamming(const vector<uint> & i, const vector<uint> & j, uint N) {
+template<class Row>
+uint rowHamming(const Row & x, const Row & y) {
 	uint counter = 0;
-	for (uint k = 0; k < N; ++k)
-		if (i[k] != j[k])
+	for (uint k = 0; k < x.size(); ++k)
+		if (x[k] != y[k])
 			++counter;
 	return counter;
 }
 
-uint unlinkAndFindBestNext(vector<vector<uint> > & Buffer, const uint pos,
-		const uint NumberOfColumns) {
-	const uint INVALID = UINT_MAX;
-	uint bestHamming = INVALID;
-	uint bestPos = INVALID;
-	for (uint k = 0; k < NumberOfColumns; ++k) {
-		const uint before = Buffer[pos][NumberOfColumns + 2 * k];
-		const uint after = Buffer[pos][NumberOfColumns + 2 * k + 1];
-		if (before < Buffer.size()) {
-			const uint h =
-					Hamming(Buffer[pos], Buffer[before], NumberOfColumns);
-			if (h < bestHamming) {
-				bestHamming = h;
-				bestPos = before;
-			}
-			Buffer[before][NumberOfColumns + 2 * k + 1] = after;
+// the rows of the row store are contiguous: we use the vector kernel
+template<std::size_t N>
+uint rowHamming(const lazyboost::array<uint, N> & x,
+		const lazyboost::array<uint, N> & y) {
+	return hammingDistance(x.begin(), y.begin(), N);
+}
+
+/**
+ * A greedy tour of a block always starts at its first row, so the block
+ * boundary breaks runs. Closing the tour into a cycle and cutting it
+ * elsewhere gives a tour starting at any row: we pick the cut (and, with
+ * STITCHSTARTANDORIENTATION, the direction) minimizing the Hamming
+ * distance to previous (the last row written before the block, or NULL)
+ * plus the distances within the block. Linear in the size of the block.
+ */
+template<class Row>
+void stitchBlock(vector<Row> & block, const Row * previous,
+		const Stitching how) {
+	const size_t n = block.size();
+	if ((how == NOSTITCHING) or (n < 2))
+		return;
+	const long closing = rowHamming(block[n - 1], block[0]);
+	long bestcost = previous == NULL ? 0 : rowHamming(*previous, block[0]);
+	size_t bestcut = 0;
+	bool bestreversed = false;
+	for (size_t k = 0; k < n; ++k) {
+		// cutting before row k trades the edge into it for the closing edge
+		const long within = k == 0 ? 0 : closing - static_cast<long> (rowHamming(
+				block[k - 1], block[k]));
+		long cost = within + (previous == NULL ? 0 : rowHamming(*previous,
+				block[k]));
+		if (cost < bestcost) {
+			bestcost = cost;
+			bestcut = k;
+			bestreversed = false;
 		}
-		if (after < Buffer.size()) {
-			const uint h = Hamming(Buffer[pos], Buffer[after], NumberOfColumns);
-			if (h < bestHamming) {
-				bestHamming = h;
-				bestPos = after;
-			}
-			Buffer[after][NumberOfColumns + 2 * k] = before;
+		if (how != STITCHSTARTANDORIENTATION)
+			continue;
+		// backwards, from the row before the cut
+		cost = within + (previous == NULL ? 0 : rowHamming(*previous,
+				block[k == 0 ? n - 1 : k - 1]));
+		if (cost < bestcost) {
+			bestcost = cost;
+			bestcut = k;
+			bestreversed = true;
 		}
-		//
 	}
-	return bestPos;
-
+	rotate(block.begin(), block.begin() + bestcut, block.end());
+	if (bestreversed)
+		reverse(block.begin(), block.end());
 }
 
-}
-template<class C>
-void MultipleListsSort(const typename C::iterator databegin,
-		const typename C::iterator dataend, vector<uint> & indexes) {
-	const uint n = dataend - databegin;
-	const uint NumberOfColumns = databegin->size();
-	if (NumberOfColumns * n == 0)
-		return; // nothing to do
-	const uint INVALID = UINT_MAX;
-	vector<uint> tmp(3 * NumberOfColumns + 1, INVALID);
-	const uint ID = 3 * NumberOfColumns;
-	vector<vector<uint> > Buffer(n, tmp);
-	for (typename C::iterator i = databegin; i != dataend; ++i) {
-		copy(i->begin(), i->end(), Buffer[i - databegin].begin());
-		Buffer[i - databegin][ID] = i - databegin; // ID
-	}
-	for (uint k = 0; k < NumberOfColumns; ++k) {
-		MultipleListsSortNS::LexicoOffset l(k, NumberOfColumns, indexes);
-		sort(Buffer.begin(), Buffer.end(), l);
-		Buffer[0][NumberOfColumns + 2 * k + 1] = Buffer[1][ID];
-		for (uint x = 1; x < Buffer.size() - 1; ++x) {
-			Buffer[x][NumberOfColumns + 2 * k + 1] = Buffer[x + 1][ID];
-			Buffer[x][NumberOfColumns + 2 * k] = Buffer[x - 1][ID];
-		}
-		Buffer[Buffer.size() - 1][NumberOfColumns + 2 * k]
-				= Buffer[Buffer.size() - 2][ID];
-	}
-	tmp.clear();
-	//tmp.resize(NumberOfColumns);
-	MultipleListsSortNS::SortOnOneKey sook(ID);
-	sort(Buffer.begin(), Buffer.end(), sook);
-	// could start from random point, but let's go...
-	uint location = 0;
-	typename C::iterator writeiter = databegin;
-	copy(Buffer[location].begin(), Buffer[location].begin() + NumberOfColumns,
-			writeiter->begin());
-	++writeiter;
-	location = MultipleListsSortNS::unlinkAndFindBestNext(Buffer, location,
-			NumberOfColumns);
-	while (location != INVALID) {
-		copy(Buffer[location].begin(),
-				Buffer[location].begin() + NumberOfColumns, writeiter->begin());
-		++writeiter;
-		location = MultipleListsSortNS::unlinkAndFindBestNext(Buffer, location,
-				NumberOfColumns);
+/**
+ * MinHash signatures of rows, seen as sets of (column, value) pairs: two
+ * rows get the same hash with a probability equal to the fraction of pairs
+ * they share (their Jaccard similarity), so rows at a small Hamming
+ * distance tend to have the same signature.
+ */
+class MinHashSignature {
+public:
+	MinHashSignature(const uint howmany, const uint64 seed = 0) :
+		mSeeds() {
+		FastRandom rng(seed);
+		for (uint k = 0; k < howmany; ++k)
+			mSeeds.push_back(rng.next());
+	}
+
+	uint size() const {
+		return mSeeds.size();
+	}
+
+	// the smallest hash of a pair of the row, for the given hash function
+	template<class RowType>
+	uint hash(const RowType & row, const uint which) const {
+		uint smallest = UINT_MAX;
+		for (uint k = 0; k < row.size(); ++k) {
+			const uint h = static_cast<uint> (FastRandom::mix(mSeeds[which]
+					^ ((static_cast<uint64> (k) << 32) | row[k])) >> 32);
+			if (h < smallest)
+				smallest = h;
+		}
+		return smallest;
+	}
+
+private:
+	vector<uint64> mSeeds;
+};
+
+/**
+ * Nearest-neighbour chaining: each row is followed by the closest (in
+ * Hamming distance) of the rows not yet chained, starting from current
+ * (the last row chained before, if any) or else from the first row. At the
+ * end, current is the last row. Quadratic in the number of rows.
+ */
+template<class Iterator, class Row>
+void greedyChain(const Iterator begin, const Iterator end, Row & current,
+		bool & hascurrent) {
+	for (Iterator pos = begin; pos != end; ++pos) {
+		if (hascurrent) {
+			Iterator best = pos;
+			uint besthamming = rowHamming(current, *pos);
+			for (Iterator i = pos + 1; (i != end) and (besthamming > 0); ++i) {
+				const uint h = rowHamming(current, *i);
+				if (h < besthamming) {
+					besthamming = h;
+					best = i;
+				}
+			}
+			iter_swap(pos, best);
+		}
+		current = *pos;
+		hascurrent = true;
 	}
 }
 
-// this is an expensive Vortex sort, which is memory conscious
+// this is an expensive Vortex sort, which is memory conscious; see
+// VortexKey for a faster way to get the same order
 class Vortex {
 public:
 	Vortex(vector<uint> & indexes) :mIndexes(indexes){
-			buffer1.reserve(indexes.size());
-			buffer2.reserve(indexes.size());
-
 	}
 	Vortex() :mIndexes(){
 	}
 	Vortex& operator=(const Vortex & v) {
 		mIndexes = v.mIndexes;
-		buffer1.reserve(v.buffer1.size());
-		buffer2.reserve(v.buffer2.size());
 		return *this;
 	}
 	template<class RowType>
 	bool operator()(const RowType & i, const RowType & j) const {
+		// one pair of buffers per thread
+		static thread_local vector<pair<uint, uint> > buffer1, buffer2;
 		buffer1.resize(i.size());
 		buffer2.resize(j.size());
 		for (uint k = 0; k < buffer1.size(); ++k) {
@@ -187,10 +368,247 @@ public:
 		return false;// they are equal in fact
 	}
 
-	static vector<pair<uint, uint> > buffer1, buffer2;
 	vector<uint> mIndexes;
 };
-vector<pair<uint, uint> > Vortex::buffer1;
-vector<pair<uint, uint> > Vortex::buffer2;
+
+/**
+ * The Vortex order as a plain lexicographic order. The key of a row holds
+ * its (value, column) pairs in increasing order, each packed in a word as
+ * value * 2^columnbits + column, and the words at odd positions are
+ * complemented since Vortex alternates directions. Comparing keys word by
+ * word then agrees with the Vortex comparator, and a key gives back its
+ * row. Keys are as wide as rows, so they are sorted in place of the rows.
+ *
+ * encode returns false if a value does not fit (it must be less than
+ * 2^(32 - columnbits)).
+ */
+class VortexKey {
+public:
+	VortexKey(const vector<uint> & indexes) :
+		mIndexes(indexes), mColumnBits(1) {
+		uint largest = 0;
+		for (uint k = 0; k < indexes.size(); ++k)
+			if (indexes[k] > largest)
+				largest = indexes[k];
+		while ((largest >> mColumnBits) != 0)
+			++mColumnBits;
+	}
+
+	template<class RowType>
+	bool encode(const RowType & row, RowType & key) const {
+		const uint n = mIndexes.size();
+		for (uint k = 0; k < n; ++k) {
+			const uint column = mIndexes[k];
+			if ((row[column] >> (32 - mColumnBits)) != 0)
+				return false;
+			key[k] = (row[column] << mColumnBits) | column;
+		}
+		sort(&key[0], &key[0] + n);
+		for (uint k = 1; k < n; k += 2)
+			key[k] = ~key[k];
+		return true;
+	}
+
+	template<class RowType>
+	void decode(const RowType & key, RowType & row) const {
+		const uint mask = (1U << mColumnBits) - 1;
+		for (uint k = 0; k < mIndexes.size(); ++k) {
+			const uint word = (k % 2 == 0) ? key[k] : ~key[k];
+			row[word & mask] = word >> mColumnBits;
+		}
+	}
+
+private:
+	vector<uint> mIndexes;
+	uint mColumnBits;
+};
+
+/**
+ * The reflected mixed-radix Gray-code order as a plain lexicographic
+ * order. Going through the columns in the order given by indexes, a column
+ * is traversed downward when the values of the columns before it add up to
+ * an odd number; the key of a row holds the steps taken by each column
+ * (value, or cardinality - 1 - value when going downward). Consecutive
+ * distinct keys then differ in one column, and a key gives back its row.
+ * Keys are as wide as rows, so they are sorted in place of the rows.
+ *
+ * encode returns false if a value is not less than the cardinality of its
+ * column.
+ */
+class GrayCodeKey {
+public:
+	GrayCodeKey(const vector<uint> & indexes, const vector<uint> & cardinalities) :
+		mIndexes(indexes), mCardinalities(cardinalities) {
+	}
+
+	template<class RowType>
+	bool encode(const RowType & row, RowType & key) const {
+		uint parity = 0;
+		for (uint k = 0; k < mIndexes.size(); ++k) {
+			const uint column = mIndexes[k];
+			if (row[column] >= mCardinalities[column])
+				return false;
+			key[k] = parity == 0 ? row[column] : mCardinalities[column] - 1
+					- row[column];
+			parity ^= row[column] & 1;
+		}
+		return true;
+	}
+
+	template<class RowType>
+	void decode(const RowType & key, RowType & row) const {
+		uint parity = 0;
+		for (uint k = 0; k < mIndexes.size(); ++k) {
+			const uint column = mIndexes[k];
+			row[column] = parity == 0 ? key[k] : mCardinalities[column] - 1
+					- key[k];
+			parity ^= row[column] & 1;
+		}
+	}
+
+private:
+	vector<uint> mIndexes;
+	vector<uint> mCardinalities;
+};
+
+/**
+ * Z-order and Hilbert-curve orders as plain lexicographic orders. Each
+ * column is a coordinate with as many bits as its cardinality needs,
+ * shifted left so that all coordinates span the same range (a column with
+ * few values only refines the order at the coarse levels). The key holds
+ * the bits of the coordinates interleaved, most significant level first
+ * and columns in the order given by indexes; for the Hilbert curve, the
+ * coordinates first go through Skilling's transform ("Programming the
+ * Hilbert curve", 2004). Keys have at most 32 bits per column, so they are
+ * as wide as rows and sorted in place of them; a key gives back its row.
+ *
+ * encode returns false if a value is not less than the cardinality of its
+ * column.
+ */
+class SpaceFillingKey {
+public:
+	enum Curve {
+		ZORDER, HILBERT
+	};
+
+	SpaceFillingKey(const vector<uint> & indexes,
+			const vector<uint> & cardinalities, const Curve curve) :
+		mIndexes(indexes), mCardinalities(cardinalities), mShifts(),
+				mBits(0), mCurve(curve) {
+		vector<uint> bits(indexes.size(), 0);
+		for (uint k = 0; k < indexes.size(); ++k) {
+			while ((bits[k] < 32) and ((cardinalities[indexes[k]] - 1)
+					>> bits[k]) != 0)
+				++bits[k];
+			if (bits[k] > mBits)
+				mBits = bits[k];
+		}
+		for (uint k = 0; k < indexes.size(); ++k)
+			mShifts.push_back(mBits - bits[k]);
+	}
+
+	template<class RowType>
+	bool encode(const RowType & row, RowType & key) const {
+		const uint n = mIndexes.size();
+		vector<uint> & x = coordinates(n);
+		for (uint k = 0; k < n; ++k) {
+			const uint column = mIndexes[k];
+			if (row[column] >= mCardinalities[column])
+				return false;
+			x[k] = mShifts[k] < 32 ? row[column] << mShifts[k] : 0;
+		}
+		if (mCurve == HILBERT)
+			axesToTranspose(x);
+		for (uint w = 0; w < key.size(); ++w)
+			key[w] = 0;
+		for (uint level = 0; level < mBits; ++level)
+			for (uint k = 0; k < n; ++k) {
+				const uint bit = level * n + k;
+				key[bit / 32] |= ((x[k] >> (mBits - 1 - level)) & 1) << (31
+						- bit % 32);
+			}
+		return true;
+	}
+
+	template<class RowType>
+	void decode(const RowType & key, RowType & row) const {
+		const uint n = mIndexes.size();
+		vector<uint> & x = coordinates(n);
+		for (uint k = 0; k < n; ++k)
+			x[k] = 0;
+		for (uint level = 0; level < mBits; ++level)
+			for (uint k = 0; k < n; ++k) {
+				const uint bit = level * n + k;
+				x[k] |= ((key[bit / 32] >> (31 - bit % 32)) & 1) << (mBits - 1
+						- level);
+			}
+		if (mCurve == HILBERT)
+			transposeToAxes(x);
+		for (uint k = 0; k < n; ++k)
+			row[mIndexes[k]] = mShifts[k] < 32 ? x[k] >> mShifts[k] : 0;
+	}
+
+private:
+	// each thread keeps its own buffer
+	static vector<uint> & coordinates(const uint n) {
+		static thread_local vector<uint> x;
+		x.resize(n);
+		return x;
+	}
+
+	void axesToTranspose(vector<uint> & x) const {
+		if (mBits == 0)
+			return;
+		const uint n = x.size();
+		const uint64 top = static_cast<uint64> (1) << (mBits - 1);
+		for (uint64 q = top; q > 1; q >>= 1) {
+			const uint p = static_cast<uint> (q - 1);
+			for (uint i = 0; i < n; ++i)
+				if (x[i] & q)
+					x[0] ^= p;
+				else {
+					const uint t = (x[0] ^ x[i]) & p;
+					x[0] ^= t;
+					x[i] ^= t;
+				}
+		}
+		for (uint i = 1; i < n; ++i)
+			x[i] ^= x[i - 1];
+		uint t = 0;
+		for (uint64 q = top; q > 1; q >>= 1)
+			if (x[n - 1] & q)
+				t ^= static_cast<uint> (q - 1);
+		for (uint i = 0; i < n; ++i)
+			x[i] ^= t;
+	}
+
+	void transposeToAxes(vector<uint> & x) const {
+		if (mBits == 0)
+			return;
+		const uint n = x.size();
+		const uint64 end = static_cast<uint64> (1) << mBits;
+		const uint t = x[n - 1] >> 1;
+		for (uint i = n - 1; i > 0; --i)
+			x[i] ^= x[i - 1];
+		x[0] ^= t;
+		for (uint64 q = 2; q != end; q <<= 1) {
+			const uint p = static_cast<uint> (q - 1);
+			for (uint i = n; i-- > 0;)
+				if (x[i] & q)
+					x[0] ^= p;
+				else {
+					const uint s = (x[0] ^ x[i]) & p;
+					x[0] ^= s;
+					x[i] ^= s;
+				}
+		}
+	}
+
+	vector<uint> mIndexes;
+	vector<uint> mCardinalities;
+	vector<uint> mShifts;
+	uint mBits;
+	Curve mCurve;
+};
 
 #endif /* ROWREORDERING_H_ */
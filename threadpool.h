@@ -0,0 +1,102 @@
+/**
+ * (c) 2026 the rowreordering contributors
+ * Apache License 2.0
+ */
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <vector>
+
+using namespace std;
+
+typedef unsigned int uint;
+
+/**
+ * A fixed-size pool of worker threads. Tasks are run in FIFO order and
+ * submit() returns a future for the result.
+ */
+class ThreadPool {
+public:
+	ThreadPool(uint numberofthreads) :
+		workers(), tasks(), mutexfortasks(), wakeup(), stopping(false) {
+		if (numberofthreads == 0)
+			numberofthreads = 1;
+		for (uint k = 0; k < numberofthreads; ++k)
+			workers.push_back(thread(&ThreadPool::work, this));
+	}
+
+	~ThreadPool() {
+		{
+			unique_lock<mutex> lock(mutexfortasks);
+			stopping = true;
+		}
+		wakeup.notify_all();
+		for (uint k = 0; k < workers.size(); ++k)
+			workers[k].join();
+	}
+
+	template<class F>
+	future<typename result_of<F()>::type> submit(F f) {
+		typedef typename result_of<F()>::type R;
+		shared_ptr<packaged_task<R()> > task(new packaged_task<R()> (f));
+		future<R> answer = task->get_future();
+		{
+			unique_lock<mutex> lock(mutexfortasks);
+			tasks.push([task]() {(*task)();});
+		}
+		wakeup.notify_one();
+		return answer;
+	}
+
+	uint size() const {
+		return workers.size();
+	}
+
+private:
+	ThreadPool(const ThreadPool &);
+	ThreadPool & operator=(const ThreadPool &);
+
+	void work() {
+		while (true) {
+			function<void()> task;
+			{
+				unique_lock<mutex> lock(mutexfortasks);
+				while (!stopping && tasks.empty())
+					wakeup.wait(lock);
+				if (tasks.empty())
+					return;// stopping
+				task = tasks.front();
+				tasks.pop();
+			}
+			task();
+		}
+	}
+
+	vector<thread> workers;
+	queue<function<void()> > tasks;
+	mutex mutexfortasks;
+	condition_variable wakeup;
+	bool stopping;
+};
+
+// shared pool for background reads and writes
+inline ThreadPool & ioThreadPool() {
+	static ThreadPool pool(4);
+	return pool;
+}
+
+// shared pool for CPU-bound work, one thread per core
+inline ThreadPool & computeThreadPool() {
+	static ThreadPool pool(thread::hardware_concurrency());
+	return pool;
+}
+
+#endif /* THREADPOOL_H_ */
@@ -8,6 +8,7 @@
 #include <getopt.h>
 #include <string.h>
 #include <memory>
+#include <sys/stat.h>
 
 #include "externalvector.h"
 
@@ -24,6 +25,11 @@ vector<shared_ptr<SimpleCODEC> > myalgos;
 enum {
 	BLOCKSIZE = 128
 };
+// the shuffles use a fixed block size (in rows), so that the published
+// results do not depend on the memory budget
+enum {
+	SHUFFLEBLOCKSIZE = 1048576
+};
 
 void initAlgos() {
 	myalgos.clear();
@@ -102,7 +108,10 @@ void testCodec(SimpleCODEC & mycodec, MyNaiveColumnStore & n,
 		uint compressiontime(0), decompressiontime(0);
 		double sizeinmb(0);
 		vector<uint> incolumn;
-		const uint MAXSIZE=10*1024*1024;// 50 million or about 50MB
+		// the input, the compressed output and the recovered copy are in
+		// memory at once, in chunks of up to 10 million values
+		MemoryLease lease(3 * 10 * 1024 * 1024 * sizeof(uint), 3 * 65536 * sizeof(uint));
+		const uint64 MAXSIZE = lease.bytes() / (3 * sizeof(uint));
 		for(uint64 begin = 0; begin<n.data[columnindex].size(); begin+=MAXSIZE) {
 			uint64 end = begin+MAXSIZE;
 			if(end > n.data[columnindex].size())
@@ -165,7 +174,8 @@ void runtests(MyNaiveColumnStore & ncs, bool skiprepeats, bool justvolume = fals
 }
 
 enum {
-	SHUFFLE, LEXICO, VORTEX, GRAYCODED, MULTIPLELISTS, BLOCKWISEMULTIPLELISTS
+	SHUFFLE, LEXICO, VORTEX, GRAYCODED, MULTIPLELISTS, BLOCKWISEMULTIPLELISTS,
+	ZORDER, HILBERT, LSH
 };
 
 
@@ -183,44 +193,92 @@ void __displayStats(CSVFlatFile & ff) {
 	cout<<"# excepted fraction = "<<c * 1.0 / ff.numberOfAttributeValues()<<endl;
 }
 
+// set by -checkpoint=DIR or ROWREORDER_CHECKPOINT, NULL otherwise
+Checkpoint * checkpoint = NULL;
+// refine the column order on a sample (see RowStore::searchColumnOrder)
+bool searchcolumnorder = false;
+// join the blocks of -multiup and -multidown (see stitchBlock)
+bool stitchblocks = false;
+
+Stitching blockStitching() {
+	return stitchblocks ? STITCHSTARTANDORIENTATION : NOSTITCHING;
+}
+
+vector<uint64> asNumbers(const vector<uint> & x) {
+	return vector<uint64>(x.begin(), x.end());
+}
+
+vector<uint> fromNumbers(const vector<uint64> & x) {
+	return vector<uint>(x.begin(), x.end());
+}
+
+// ff is NULL when we resume from the checkpoint
 template<int c>
-void __readCSV(CSVFlatFile & ff, int sort, int columnorderheuristic,
+void __readCSV(CSVFlatFile * ff, int sort, int columnorderheuristic,
 		bool skiprepeats, const uint sample, const uint64 maxsize, const bool makeColumnIndependent) {
 	ZTimer z;
+	RowStore<c> rs;
+	vector<uint> indexes, cardinalities;
+	NaiveColumnStore<c> ncs;
+	if(ff == NULL) {
+		rs.data.attach(checkpoint->path("input"), checkpoint->getNumbers("input.rows")[0]);
+		indexes = fromNumbers(checkpoint->getNumbers("input.indexes"));
+		cardinalities = fromNumbers(checkpoint->getNumbers("input.cardinalities"));
+		cout << "# " << z.split() << " ms to reopen " << rs.size()
+				<< " bytes from the checkpoint" << endl;
+	} else {
 	cout<<"#Loading into row store..."<<endl;
 	//printMemoryUsage();
-	RowStore<c> rs(ff,0);
-	ff.close();
+	RowStore<c> loaded(*ff,0);
+	rs.data = std::move(loaded.data);
+	ff->close();
 	cout << "# " << z.split() << " ms to load " << rs.size()
 			<< " bytes into row store" << endl;
 	if(sample>0) {
 		    z.reset();
  		    RowStore<c> rstmp;
 			rs.fillWithSample(sample,rstmp);
-			rs.data.swap(rstmp.data);
+			rs.data = std::move(rstmp.data);
 			cout << "# " << z.split() << " ms to extract sample containing "<< sample<<" tuples" << endl;
 
 	}
 	cout << "# detected " << c << " columns" << endl;
-	vector<uint> indexes = ff.computeColumnOrderAndReturnColumnIndexes(
+	indexes = ff->computeColumnOrderAndReturnColumnIndexes(
 			columnorderheuristic);
+	cardinalities = ff->getColumnCardinalities();
+	if(searchcolumnorder) {
+		z.reset();
+		indexes = rs.searchColumnOrder(indexes);
+		cout << "# " << z.split() << " ms to search the column order" << endl;
+	}
 	cout<<"# clearing histogram memory..."<<endl;
-	ff.clear();
+	ff->clear();
 	//cout<<"# fraction of tuples with zeroes = "<<  rs.countZeroes() * 1. / (rs.data.size() * c)<<endl;
-	cout<<"# sorting..."<<endl;
-	NaiveColumnStore<c> ncs;
 	if(makeColumnIndependent) {
 		cout<<"# shuffling columns independently"<<endl;
 		cout<<"# shuffling columns independently (part 1: loading into column store)"<<endl;
 		ncs.reloadFromRowStore(rs);
 		cout<<"# shuffling columns independently (part 2: shuffling)"<<endl;
-		ncs.makeColumnsIndependent();
+		ncs.makeColumnsIndependent(SHUFFLEBLOCKSIZE);
 		cout<<"# shuffling columns independently (part 3: copying back to row store)"<<endl;
 		ncs.copyToRowStore(rs);
 	}
+	if(checkpoint != NULL) {
+		// from now on, a crash does not require parsing the CSV file again
+		rs.data.persistAs(checkpoint->path("input"));
+		checkpoint->setNumbers("input.columns", vector<uint64>(1, c));
+		checkpoint->setNumbers("input.rows", vector<uint64>(1, rs.data.size()));
+		checkpoint->setNumbers("input.indexes", asNumbers(indexes));
+		checkpoint->setNumbers("input.cardinalities", asNumbers(cardinalities));
+		checkpoint->set("input.done", "1");
+		checkpoint->save();
+	}
+	}
+	rs.setCheckpoint(checkpoint);
+	cout<<"# sorting..."<<endl;
 	if (sort == LEXICO) {
 		z.reset();
-		rs.sortRows(indexes);
+		rs.sortRows(indexes, cardinalities);
 		cout << "# " << z.split() << " ms to sort rows" << endl;
 		if(maxsize>0) rs.top(maxsize,rs);
 		z.reset();
@@ -229,15 +287,28 @@ void __readCSV(CSVFlatFile & ff, int sort, int columnorderheuristic,
 		cout << "# " << z.split() << " ms to reload " << ncs.size()
 				<< " bytes into column store" << endl;
 	} else if (sort == MULTIPLELISTS) {
-		cout << "not supported" << endl;
+		z.reset();
+		rs.sortRows(indexes, cardinalities);
+		cout << "# " << z.split() << " ms to sort rows lexicographically"
+				<< endl;
+		if(maxsize>0) rs.top(maxsize,rs);
+		z.reset();
+		rs.MultipleListsSortRows(indexes);
+		cout << "# " << z.split() << " ms to sort all rows in multiplelists order"
+				<< endl;
+		z.reset();
+		ncs.reloadFromRowStore(rs);
+		rs.clear();
+		cout << "# " << z.split() << " ms to reload " << ncs.size()
+				<< " bytes into column store" << endl;
 	} else if (sort == BLOCKWISEMULTIPLELISTS) {
 		z.reset();
-		rs.sortRows(indexes);
+		rs.sortRows(indexes, cardinalities);
 		cout << "# " << z.split() << " ms to sort rows lexicographically"
 				<< endl;
 		if(maxsize>0) rs.top(maxsize,rs);
 		z.reset();
-		rs.MultipleListsSortRowsPerBlock(indexes, 131072);//65536);
+		rs.MultipleListsSortRowsPerBlock(indexes, 131072, blockStitching());//65536);
 		cout << "# " << z.split() << " ms to sort rows in multiplelists order"
 				<< endl;
 		z.reset();
@@ -256,10 +327,40 @@ void __readCSV(CSVFlatFile & ff, int sort, int columnorderheuristic,
 		cout << "# " << z.split() << " ms to reload " << ncs.size()
 				<< " bytes into column store" << endl;
 	} else if (sort == GRAYCODED) {
-		cerr << "not supported" << endl;
+		z.reset();
+		rs.grayCodeSortRows(indexes, cardinalities);
+		cout << "# " << z.split() << " ms to sort rows in Gray-code order" << endl;
+		if(maxsize>0) rs.top(maxsize,rs);
+		z.reset();
+		ncs.reloadFromRowStore(rs);
+		rs.clear();
+		cout << "# " << z.split() << " ms to reload " << ncs.size()
+				<< " bytes into column store" << endl;
+	} else if ((sort == ZORDER) or (sort == HILBERT)) {
+		z.reset();
+		rs.spaceFillingSortRows(indexes, sort == HILBERT ? SpaceFillingKey::HILBERT
+				: SpaceFillingKey::ZORDER, cardinalities);
+		cout << "# " << z.split() << " ms to sort rows in "
+				<< (sort == HILBERT ? "Hilbert" : "Z") << " order" << endl;
+		if(maxsize>0) rs.top(maxsize,rs);
+		z.reset();
+		ncs.reloadFromRowStore(rs);
+		rs.clear();
+		cout << "# " << z.split() << " ms to reload " << ncs.size()
+				<< " bytes into column store" << endl;
+	} else if (sort == LSH) {
+		z.reset();
+		rs.lshSortRows(indexes);
+		cout << "# " << z.split() << " ms to sort rows by LSH chaining" << endl;
+		if(maxsize>0) rs.top(maxsize,rs);
+		z.reset();
+		ncs.reloadFromRowStore(rs);
+		rs.clear();
+		cout << "# " << z.split() << " ms to reload " << ncs.size()
+				<< " bytes into column store" << endl;
 	} else {// shuffling
 		z.reset();
-		rs.shuffleRows();
+		rs.shuffleRows(SHUFFLEBLOCKSIZE);
 		cout << "# " << z.split() << " ms to shuffle rows" << endl;
 		if(maxsize>0) rs.top(maxsize,rs);
 		z.reset();
@@ -274,6 +375,10 @@ void __readCSV(CSVFlatFile & ff, int sort, int columnorderheuristic,
 	cout << "# block size = " << BLOCKSIZE << endl;
 	runtests(ncs, skiprepeats);
 	ncs.clear();
+	if(checkpoint != NULL)
+		checkpoint->clear();// the job is done
+	IOStatistics::instance().print(cout);
+	IOStatistics::instance().reset();
 }
 
 
@@ -290,25 +395,28 @@ void __growCSV(CSVFlatFile & ff,  int columnorderheuristic) {
 	cout << "# detected " << c << " columns" << endl;
 	vector<uint> indexes = ff.computeColumnOrderAndReturnColumnIndexes(
 			columnorderheuristic);
+	vector<uint> cardinalities = ff.getColumnCardinalities();
 	cout<<"# clearing histogram memory..."<<endl;
 	ff.clear();
-	rs.sortRows(indexes);
+	rs.sortRows(indexes, cardinalities);
+	// the prefixes of the lexicographically sorted table are just views
+	NaiveColumnStore<c> lexico;
+	lexico.reloadFromRowStore(rs);
 	NaiveColumnStore<c> ncs;
 	for(uint k = 131072*20; k<=rs.data.size();k+=131072*20) {
         //rstmp.sortRows(indexes);
-		ncs.reloadFromRowStore(rs,k);
+		ColumnStoreView lexicotop = lexico.top(k);
 		cout<<"#=============================#"<<endl;
 		cout<<"# number of rows = "<<k<<endl;
 		cout<<"#=============================#"<<endl;
 		cout<<"# lexico  "<<endl;
-		runtests(ncs, true,  true);
-		cout << "# got RunCount = " << ncs.computeRunCount() << endl;
-		ncs.clear();
+		runtests(lexicotop, true,  true);
+		cout << "# got RunCount = " << lexicotop.computeRunCount() << endl;
 		cout<<"############################"<<endl;
 		cout<<"# multiple list  "<<endl;
 		RowStore<c> rstmp;
 		rs.top(k,rstmp);
-		rstmp.MultipleListsSortRowsPerBlock(indexes, 131072);
+		rstmp.MultipleListsSortRowsPerBlock(indexes, 131072, blockStitching());
 		ncs.reloadFromRowStore(rstmp);
 		runtests(ncs, true,  true);
 		rstmp.clear();
@@ -318,6 +426,7 @@ void __growCSV(CSVFlatFile & ff,  int columnorderheuristic) {
 	}
 	rs.clear();
 	ncs.clear();
+	lexico.clear();
 }
 
 
@@ -334,13 +443,14 @@ void __scaleCSV(CSVFlatFile & ff) {
 	cout << "# detected " << c << " columns" << endl;
 	vector<uint> indexes = ff.computeColumnOrderAndReturnColumnIndexes(
 			INCREASINGCARDINALITY);
+	vector<uint> cardinalities = ff.getColumnCardinalities();
 	cout<<"# clearing histogram memory..."<<endl;
 	ff.clear();
 
 	cout<<"# sorting..."<<endl;
 	if (true) {
 		z.reset();
-		rs.sortRows(indexes);
+		rs.sortRows(indexes, cardinalities);
 		cout << "# " << z.split() << " ms to sort rows" << endl;
 		z.reset();
 		NaiveColumnStore<c> ncs;
@@ -361,7 +471,7 @@ void __scaleCSV(CSVFlatFile & ff) {
 		for (uint blocksize = 16; blocksize <= min(8388608,numberofrows); blocksize *= 2) {
 			cout << "# blocksize " << blocksize << " rows" << endl;
 			z.reset();
-			rs.MultipleListsSortRowsPerBlock(indexes, blocksize);//65536);
+			rs.MultipleListsSortRowsPerBlock(indexes, blocksize, blockStitching());//65536);
 			cout << "# " << z.split()
 					<< " ms to sort rows in multiplelists order with blocksize =  "
 					<< blocksize << endl;
@@ -400,60 +510,81 @@ void __scaleCSV(CSVFlatFile & ff) {
 void readCSV(char * filename, int sort, const int normtype,
 		int columnorderheuristic,
 		bool skiprepeats, const uint sample, const uint64 maxsize, const bool makeColumnIndependent) {
-	cout << "# loading CSV file \"" << filename << "\" from disk" << endl;
-	CSVFlatFile ff(filename, normtype);
-	cout<<"#file loaded"<<endl;
-	const uint c = ff.getNumberOfColumns();
+	// a checkpoint left by the same job lets us skip the parsing
+	ostringstream settings;
+	struct stat st;
+	if (stat(filename, &st) == 0)
+		settings << filename << " " << st.st_size << " " << st.st_mtime;
+	settings << " " << sort << " " << normtype << " " << columnorderheuristic
+			<< " " << sample << " " << maxsize << " " << makeColumnIndependent
+			<< " " << searchcolumnorder << " " << stitchblocks;
+	unique_ptr<CSVFlatFile> ff;
+	uint c;
+	if ((checkpoint != NULL) and (checkpoint->get("input.settings")
+			== settings.str()) and checkpoint->has("input.done")) {
+		cout << "# resuming from checkpoint in " << checkpoint->directory()
+				<< endl;
+		c = checkpoint->getNumbers("input.columns")[0];
+	} else {
+		if (checkpoint != NULL) {
+			checkpoint->clear();// left by another job
+			checkpoint->set("input.settings", settings.str());
+		}
+		cout << "# loading CSV file \"" << filename << "\" from disk" << endl;
+		ff.reset(new CSVFlatFile(filename, normtype));
+		cout<<"#file loaded"<<endl;
+		c = ff->getNumberOfColumns();
+	}
 	// this is an ugly hack to get around the limitations
 	// of STXXL which I ended up no using, so this was wasted hacking
 	switch (c) {
 	case 1:
-		__readCSV<1> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<1> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 2:
-		__readCSV<2> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<2> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 3:
-		__readCSV<3> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<3> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 4:
-		__readCSV<4> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<4> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 5:
-		__readCSV<5> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<5> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 6:
-		__readCSV<6> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<6> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 7:
-		__readCSV<7> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<7> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 8:
-		__readCSV<8> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<8> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 9:
-		__readCSV<9> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<9> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 10:
-		__readCSV<10> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<10> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 16:
-		__readCSV<16> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<16> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 19:
-		__readCSV<19> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<19> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 15:
-		__readCSV<15> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<15> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 17:
-		__readCSV<17> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<17> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 41:
-		__readCSV<41> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<41> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	case 42:
-		__readCSV<42> (ff, sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
+		__readCSV<42> (ff.get(), sort, columnorderheuristic, skiprepeats,sample,maxsize, makeColumnIndependent);
 		break;
 	default:
 		cerr << " # of columns " << c
@@ -663,9 +794,31 @@ void scaleCSV(char * filename, const int normtype) {
 
 int main(int argc, char **argv) {
 	if (argc < 2) {
-		cerr << " usage : tods2011 filename.csv " << endl;
+		cerr << " usage : tods2011 [-memory=SIZE] [-checkpoint=DIR] [-columnorder=search] [-stitch] [-flag] filename.csv " << endl;
 		return -1;
 	}
+	checkpoint = Checkpoint::fromEnvironment();
+	// the memory budget (e.g., -memory=4G) overrides ROWREORDER_MEMORY and
+	// -checkpoint=DIR overrides ROWREORDER_CHECKPOINT; -columnorder=search
+	// starts from the cardinality heuristic and improves it on a sample;
+	// -stitch joins the blocks of the block-wise multiple-lists order
+	while (argc > 2) {
+		if (strncmp(argv[1], "-memory=", 8) == 0)
+			MemoryGovernor::instance().setBudget(MemoryGovernor::parseSize(argv[1] + 8));
+		else if (strncmp(argv[1], "-checkpoint=", 12) == 0) {
+			delete checkpoint;
+			checkpoint = new Checkpoint(argv[1] + 12);
+		} else if (strcmp(argv[1], "-columnorder=search") == 0)
+			searchcolumnorder = true;
+		else if (strcmp(argv[1], "-stitch") == 0)
+			stitchblocks = true;
+		else
+			break;
+		--argc;
+		++argv;
+	}
+	cout << "# memory budget: " << MemoryGovernor::instance().budget() / (1024 * 1024)
+			<< " MB" << endl;
 	uint maxsize = 0;
 	uint sample = 0; // by default, don't sample
 	int normtype = CSVFlatFile::FREQNORMALISATION;
@@ -712,6 +865,50 @@ int main(int argc, char **argv) {
 			cout << "#sort--vortex decreasing column cardinality " << filename << endl;
 			readCSV(filename, VORTEX, normtype, DECREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
 			return 0;
+		} else if(strcmp(parameter,"-grayup")==0) {
+			cout << "#sort--graycode increasing column cardinality " << filename << endl;
+			readCSV(filename, GRAYCODED, normtype, INCREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+			return 0;
+		} else if(strcmp(parameter,"-graydown")==0) {
+			cout << "#sort--graycode decreasing column cardinality " << filename << endl;
+			readCSV(filename, GRAYCODED, normtype, DECREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+			return 0;
+		} else if(strcmp(parameter,"-zorderup")==0) {
+			cout << "#sort--zorder increasing column cardinality " << filename << endl;
+			readCSV(filename, ZORDER, normtype, INCREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+			return 0;
+		} else if(strcmp(parameter,"-zorderdown")==0) {
+			cout << "#sort--zorder decreasing column cardinality " << filename << endl;
+			readCSV(filename, ZORDER, normtype, DECREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+			return 0;
+		} else if(strcmp(parameter,"-hilbertup")==0) {
+			cout << "#sort--hilbert increasing column cardinality " << filename << endl;
+			readCSV(filename, HILBERT, normtype, INCREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+			return 0;
+		} else if(strcmp(parameter,"-hilbertdown")==0) {
+			cout << "#sort--hilbert decreasing column cardinality " << filename << endl;
+			readCSV(filename, HILBERT, normtype, DECREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+			return 0;
+		} else if(strcmp(parameter,"-lshup")==0) {
+			cout << "#sort--lsh increasing column cardinality " << filename << endl;
+			readCSV(filename, LSH, normtype, INCREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+			return 0;
+		} else if(strcmp(parameter,"-lshdown")==0) {
+			cout << "#sort--lsh decreasing column cardinality " << filename << endl;
+			readCSV(filename, LSH, normtype, DECREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+			return 0;
+		} else if(strcmp(parameter,"-fullmultiup")==0) {
+			cout << "#sort--multiplelists increasing column cardinality "
+					<< filename << endl;
+			readCSV(filename, MULTIPLELISTS, normtype, INCREASINGCARDINALITY,
+					false, sample,maxsize,makeColumnIndependent);
+			return 0;
+		} else if(strcmp(parameter,"-fullmultidown")==0) {
+			cout << "#sort--multiplelists decreasing column cardinality "
+					<< filename << endl;
+			readCSV(filename, MULTIPLELISTS, normtype, DECREASINGCARDINALITY,
+					false, sample,maxsize,makeColumnIndependent);
+			return 0;
 		} else if(strcmp(parameter,"-multiup")==0) {
 			cout << "#sort--blockwisemultiplelists increasing column cardinality "
 					<< filename << endl;
@@ -744,6 +941,18 @@ int main(int argc, char **argv) {
 	cout << "#sort--vortex decreasing column cardinality " << filename << endl;
 	readCSV(filename, VORTEX, normtype, DECREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
 	cout << endl;
+	cout << "#sort--graycode increasing column cardinality " << filename << endl;
+	readCSV(filename, GRAYCODED, normtype, INCREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+	cout << endl;
+	cout << "#sort--graycode decreasing column cardinality " << filename << endl;
+	readCSV(filename, GRAYCODED, normtype, DECREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+	cout << endl;
+	cout << "#sort--zorder increasing column cardinality " << filename << endl;
+	readCSV(filename, ZORDER, normtype, INCREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+	cout << endl;
+	cout << "#sort--hilbert increasing column cardinality " << filename << endl;
+	readCSV(filename, HILBERT, normtype, INCREASINGCARDINALITY, false, sample,maxsize,makeColumnIndependent);
+	cout << endl;
 	cout << "#sort--blockwisemultiplelists increasing column cardinality "
 			<< filename << endl;
 	readCSV(filename, BLOCKWISEMULTIPLELISTS, normtype, INCREASINGCARDINALITY,